@@ -0,0 +1,161 @@
+#include "dirwalkReader.h"
+#include <errno.h>
+#include <time.h>
+
+#define DEFAULT_FILES  100000
+#define DEFAULT_ROUNDS 5
+
+static const char *name_parts[] = {
+    "build", "Build", "cache", "Cache", "artifact", "_tmp", "obj", "Obj",
+    "äpfel", "Zebra", "zebra", "ébène", "data", "DATA", "log-", "log_",
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_tree(const char *dir, int files) {
+    char path[PATH_MAX];
+    unsigned seed = 12345;
+    size_t parts = sizeof(name_parts) / sizeof(name_parts[0]);
+
+    for (int i = 0; i < files; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int len = snprintf(path, sizeof(path), "%s/%s%u.%s", dir,
+                           name_parts[(seed >> 8) % parts], (seed >> 4) % 100000,
+                           name_parts[(seed >> 20) % parts]);
+        if (len < 0 || (size_t)len >= sizeof(path)) {
+            fprintf(stderr, "bench_collate: path too long\n");
+            return -1;
+        }
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    return 0;
+}
+
+static void remove_tree(const char *dir) {
+    struct dirent **namelist;
+    int n = scandir(dir, &namelist, NULL, NULL);
+    char path[PATH_MAX];
+    for (int i = 0; i < n; i++) {
+        if (strcmp(namelist[i]->d_name, ".") != 0 && strcmp(namelist[i]->d_name, "..") != 0) {
+            snprintf(path, sizeof(path), "%s/%s", dir, namelist[i]->d_name);
+            unlink(path);
+        }
+        free(namelist[i]);
+    }
+    if (n >= 0)
+        free(namelist);
+    rmdir(dir);
+}
+
+static int skip_dots(const struct dirent *entry) {
+    return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+int main(int argc, char *argv[]) {
+    int files = argc > 1 ? atoi(argv[1]) : DEFAULT_FILES;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (files <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [files] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    setlocale(LC_COLLATE, "");
+    const char *tmp = getenv("TMPDIR");
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/dirwalk-bench-XXXXXX", tmp ? tmp : "/tmp");
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    if (make_tree(dir, files) < 0) {
+        remove_tree(dir);
+        return EXIT_FAILURE;
+    }
+
+    double best_alpha = 1e9, best_keys = 1e9, best_read = 1e9;
+    int mismatch = 0;
+    int failed = 0;
+    int count = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        double t0 = now_sec();
+        struct dirent **namelist;
+        int n = scandir(dir, &namelist, skip_dots, alphasort);
+        double t1 = now_sec();
+        if (n < 0) {
+            perror("scandir");
+            break;
+        }
+
+        int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DirList list = {0};
+        double t2 = now_sec();
+        if (fd < 0 || dir_list_read(fd, &list) < 0) {
+            perror("getdents");
+            if (fd >= 0)
+                close(fd);
+            dir_list_free(&list);
+            for (int k = 0; k < n; k++)
+                free(namelist[k]);
+            free(namelist);
+            failed = 1;
+            break;
+        }
+        double t_read = now_sec();
+        dir_list_sort(&list);
+        double t3 = now_sec();
+        if (t_read - t2 < best_read)
+            best_read = t_read - t2;
+        close(fd);
+
+        DirCursor cursor = {0};
+        const DirEntry *entry;
+        int i = 0;
+        while ((entry = dir_list_next(&list, &cursor)) != NULL) {
+            if (i >= n || strcmp(entry->name, namelist[i]->d_name) != 0)
+                mismatch = 1;
+            i++;
+        }
+        if (i != n)
+            mismatch = 1;
+        count = n;
+
+        for (int k = 0; k < n; k++)
+            free(namelist[k]);
+        free(namelist);
+        dir_list_free(&list);
+
+        if (t1 - t0 < best_alpha)
+            best_alpha = t1 - t0;
+        if (t3 - t2 < best_keys)
+            best_keys = t3 - t2;
+    }
+
+    if (failed) {
+        dir_list_release_spares();
+        remove_tree(dir);
+        return EXIT_FAILURE;
+    }
+
+    printf("locale:            %s\n", setlocale(LC_COLLATE, NULL));
+    printf("entries:           %d\n", count);
+    printf("scandir+alphasort: %.3f ms\n", best_alpha * 1e3);
+    printf("getdents+strxfrm:  %.3f ms\n", best_keys * 1e3);
+    printf("  of which read:   %.3f ms\n", best_read * 1e3);
+    printf("speedup:           %.2fx\n", best_keys > 0 ? best_alpha / best_keys : 0.0);
+    printf("order:             %s\n", mismatch ? "MISMATCH" : "identical");
+
+    dir_list_release_spares();
+    remove_tree(dir);
+    return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#include "dirwalkFunc.h"
+#include "dirwalkDu.h"
+#include <errno.h>
+#include <time.h>
+
+#define DEFAULT_DIRS   200
+#define DEFAULT_FILES  100
+#define DEFAULT_ROUNDS 5
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_tree(const char *dir) {
+    char path[PATH_MAX];
+    for (int d = 0; d < DEFAULT_DIRS; d++) {
+        int len = snprintf(path, sizeof(path), "%s/d%03d", dir, d);
+        if (len < 0 || (size_t)len >= sizeof(path) || (mkdir(path, 0755) < 0 && errno != EEXIST)) {
+            perror(path);
+            return -1;
+        }
+        for (int f = 0; f < DEFAULT_FILES; f++) {
+            len = snprintf(path, sizeof(path), "%s/d%03d/f%03d", dir, d, f);
+            if (len < 0 || (size_t)len >= sizeof(path)) {
+                fprintf(stderr, "bench_statx: path too long\n");
+                return -1;
+            }
+            int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                perror(path);
+                return -1;
+            }
+            if (write(fd, path, (size_t)len) < 0)
+                perror(path);
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+static void remove_tree(const char *dir) {
+    char path[PATH_MAX];
+    for (int d = 0; d < DEFAULT_DIRS; d++) {
+        for (int f = 0; f < DEFAULT_FILES; f++) {
+            snprintf(path, sizeof(path), "%s/d%03d/f%03d", dir, d, f);
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "%s/d%03d", dir, d);
+        rmdir(path);
+    }
+    rmdir(dir);
+}
+
+/* Dropping the page cache needs root; without it every round is warm. */
+static int drop_caches(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+/* Runs the serial walker in --du mode (a stat per entry) with its output
+ * thrown away. */
+static double run_walk(const char *dir, int uring, int cold) {
+    if (cold && drop_caches() < 0)
+        return -1;
+
+    Options options = { .separator = '\n', .jobs = 1, .uring = uring };
+    options.du = du_new(DU_DEFAULT_TOP);
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    double t0 = now_sec();
+    walk_directory(dir, &options, 0);
+    double t1 = now_sec();
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    du_free(options.du);
+    return t1 - t0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : NULL;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: %s [dir] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char dir[PATH_MAX];
+    if (!path) {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(dir, sizeof(dir), "%s/dirwalk-statx-XXXXXX", tmp ? tmp : "/tmp");
+        if (!mkdtemp(dir)) {
+            perror("mkdtemp");
+            return EXIT_FAILURE;
+        }
+        if (make_tree(dir) < 0) {
+            remove_tree(dir);
+            return EXIT_FAILURE;
+        }
+    }
+    const char *root = path ? path : dir;
+    int cold = getenv("DIRWALK_BENCH_COLD") != NULL;
+
+    double best[2] = { 1e9, 1e9 };
+    for (int r = 0; r < rounds; r++) {
+        for (int uring = 0; uring < 2; uring++) {
+            double t = run_walk(root, uring, cold);
+            if (t < 0) {
+                fprintf(stderr, "bench_statx: cannot drop caches, measuring warm\n");
+                cold = 0;
+                t = run_walk(root, uring, 0);
+            }
+            if (t < best[uring])
+                best[uring] = t;
+        }
+    }
+
+    printf("tree:              %s\n", root);
+    printf("cache:             %s\n", cold ? "cold" : "warm");
+    printf("sync fstatat:      %.3f ms\n", best[0] * 1e3);
+    printf("io_uring statx:    %.3f ms\n", best[1] * 1e3);
+    printf("speedup:           %.2fx\n", best[1] > 0 ? best[0] / best[1] : 0.0);
+
+    if (!path)
+        remove_tree(dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,382 @@
+#include "dirwalkLib.h"
+#include "dirwalkDu.h"
+#include "dirwalkInodeSet.h"
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+#define DEFAULT_FANOUT  4
+#define DEFAULT_DEPTH   4
+#define DEFAULT_FILES   16
+#define DEFAULT_LINKS   0.1
+#define DEFAULT_ROUNDS  5
+
+typedef struct {
+    int fanout;
+    int depth;
+    int files;
+    double links;
+    unsigned seed;
+    size_t entries;
+} TreeSpec;
+
+typedef struct {
+    const char *name;
+    int sort;
+    int filter;
+    int jobs;
+    int max_fds;
+    int uring;
+    int du;
+    int follow;
+} Mode;
+
+/* Every backend the CLI can pick, on the same tree. */
+static const Mode modes[] = {
+    { .name = "unsorted" },
+    { .name = "sorted", .sort = 1 },
+    { .name = "filtered", .filter = 1 },
+    { .name = "du", .du = 1 },
+    { .name = "follow", .follow = 1 },
+    { .name = "parallel4", .jobs = 4 },
+    { .name = "parallel4-sorted", .sort = 1, .jobs = 4 },
+    { .name = "bounded8", .max_fds = 8 },
+    { .name = "bounded8-sorted", .sort = 1, .max_fds = 8 },
+    { .name = "uring-du", .uring = 1, .du = 1 },
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned next_seed(TreeSpec *spec) {
+    spec->seed = spec->seed * 1103515245u + 12345u;
+    return spec->seed >> 8;
+}
+
+/* Each directory gets `files` entries, a `links` share of them symlinks to
+ * the previous regular file, and `fanout` subdirectories down to `depth`. */
+/* SIGINT, SIGTERM (timeout), SIGHUP and SIGPIPE only set this flag; the
+ * main loop stops at the next check, removes the tree and re-raises. */
+static volatile sig_atomic_t stop_signal;
+
+static void on_signal(int sig) {
+    stop_signal = sig;
+}
+
+static void catch_signals(void) {
+    static const int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGPIPE };
+    struct sigaction sa = { .sa_handler = on_signal, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        sigaction(signals[i], &sa, NULL);
+}
+
+static int make_level(TreeSpec *spec, char *path, size_t len, int level) {
+    const char *last = NULL;
+    char last_name[32];
+    if (stop_signal)
+        return -1;
+    for (int f = 0; f < spec->files; f++) {
+        int n = snprintf(path + len, PATH_MAX - len, "/f%04d.dat", f);
+        if (n < 0 || len + (size_t)n >= PATH_MAX) {
+            fprintf(stderr, "bench_tree: path too long\n");
+            return -1;
+        }
+        int is_link = last && (next_seed(spec) % 1000) < (unsigned)(spec->links * 1000);
+        if (is_link) {
+            if (symlink(last, path) < 0) {
+                perror(path);
+                return -1;
+            }
+        } else {
+            int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                perror(path);
+                return -1;
+            }
+            if (write(fd, path, len + (size_t)n) < 0)
+                perror(path);
+            close(fd);
+            snprintf(last_name, sizeof(last_name), "f%04d.dat", f);
+            last = last_name;
+        }
+        spec->entries++;
+    }
+    if (level >= spec->depth)
+        return 0;
+    for (int d = 0; d < spec->fanout; d++) {
+        int n = snprintf(path + len, PATH_MAX - len, "/d%03d", d);
+        if (n < 0 || len + (size_t)n >= PATH_MAX) {
+            fprintf(stderr, "bench_tree: path too long\n");
+            return -1;
+        }
+        if (mkdir(path, 0755) < 0) {
+            perror(path);
+            return -1;
+        }
+        spec->entries++;
+        if (make_level(spec, path, len + (size_t)n, level + 1) < 0)
+            return -1;
+    }
+    path[len] = '\0';
+    return 0;
+}
+
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t cap;
+} PathList;
+
+static int collect(EntryInfo *entry, const char *path, size_t len, void *arg) {
+    (void)entry;
+    PathList *list = arg;
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 1024;
+        char **tmp = realloc(list->paths, list->cap * sizeof(char *));
+        if (!tmp) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        list->paths = tmp;
+    }
+    if (!(list->paths[list->count++] = strndup(path, len))) {
+        perror("strndup");
+        exit(EXIT_FAILURE);
+    }
+    return WALK_CONTINUE;
+}
+
+/* The walker lists parents before children, so removing in reverse order
+ * empties every directory before its rmdir. */
+static void remove_tree(const char *dir) {
+    Options options;
+    dirwalk_options_init(&options);
+    PathList list = {0};
+    dirwalk_visit(dir, &options, collect, &list);
+    for (size_t i = list.count; i-- > 0;) {
+        if (unlink(list.paths[i]) < 0)
+            rmdir(list.paths[i]);
+        free(list.paths[i]);
+    }
+    free(list.paths);
+    rmdir(dir);
+}
+
+static int drop_caches(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+/* Runs one walk through the library with stdout thrown away. */
+static void run_mode(const char *dir, const Mode *mode) {
+    Options options;
+    dirwalk_options_init(&options);
+    options.sort_output = mode->sort;
+    options.show_files = mode->filter;
+    options.jobs = mode->jobs ? mode->jobs : 1;
+    options.max_fds = mode->max_fds;
+    options.uring = mode->uring;
+    options.follow_links = mode->follow;
+    InodeSet visited;
+    if (mode->follow) {
+        inode_set_init_lockfree(&visited, INODE_FAST_SLOTS);
+        options.visited = &visited;
+    }
+    if (mode->du)
+        options.du = du_new(DU_DEFAULT_TOP);
+
+    dirwalk_run(dir, &options, mode->filter);
+
+    du_free(options.du);
+    if (mode->follow)
+        inode_set_destroy(&visited);
+}
+
+static double time_mode(const char *dir, const Mode *mode) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    double t0 = now_sec();
+    run_mode(dir, mode);
+    double t1 = now_sec();
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return t1 - t0;
+}
+
+#ifdef __linux__
+
+/* Counts the system calls of one walk: a forked child runs it under
+ * PTRACE_SYSCALL, every thread included. Each call stops twice (entry and
+ * exit), so the count is half the syscall stops. Returns -1 where ptrace is
+ * not permitted. */
+static long count_syscalls(const char *dir, const Mode *mode) {
+    pid_t child = fork();
+    if (child < 0)
+        return -1;
+    if (child == 0) {
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        dup2(null, STDOUT_FILENO);
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+            _exit(2);
+        raise(SIGSTOP);
+        run_mode(dir, mode);
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        waitpid(child, &status, 0);
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, child, NULL,
+           (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+
+    long stops = 0;
+    for (;;) {
+        pid_t t = waitpid(-1, &status, __WALL);
+        if (t < 0)
+            break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (t == child)
+                break;
+            continue;
+        }
+        int sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80)) {
+            stops++;
+            sig = 0;
+        } else if (sig == SIGTRAP || sig == SIGSTOP) {
+            /* Clone events and the initial stop of new threads. */
+            sig = 0;
+        }
+        ptrace(PTRACE_SYSCALL, t, NULL, (void *)(long)sig);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return (stops + 1) / 2;
+}
+
+#else
+
+static long count_syscalls(const char *dir, const Mode *mode) {
+    (void)dir;
+    (void)mode;
+    return -1;
+}
+
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f fanout] [-d depth] [-n files] [-l link_ratio] [-r rounds] [-c] [dir]\n"
+            "  -c  also measure with a cold cache (needs root); same as DIRWALK_BENCH_COLD=1\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+/* One CSV row per mode and cache state on stdout; rows with cold timing
+ * only appear when the page cache could be dropped. */
+int main(int argc, char *argv[]) {
+    TreeSpec spec = {
+        .fanout = DEFAULT_FANOUT,
+        .depth = DEFAULT_DEPTH,
+        .files = DEFAULT_FILES,
+        .links = DEFAULT_LINKS,
+        .seed = 12345,
+    };
+    int rounds = DEFAULT_ROUNDS;
+    int cold = getenv("DIRWALK_BENCH_COLD") != NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:n:l:r:c")) != -1) {
+        switch (opt) {
+            case 'f': spec.fanout = atoi(optarg); break;
+            case 'd': spec.depth = atoi(optarg); break;
+            case 'n': spec.files = atoi(optarg); break;
+            case 'l': spec.links = atof(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'c': cold = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (spec.fanout < 0 || spec.depth < 0 || spec.files < 0 || rounds <= 0 ||
+        spec.links < 0 || spec.links > 1 || optind + 1 < argc)
+        usage(argv[0]);
+
+    char dir[PATH_MAX];
+    const char *parent = optind < argc ? argv[optind] : getenv("TMPDIR");
+    snprintf(dir, sizeof(dir), "%s/dirwalk-tree-XXXXXX", parent ? parent : "/tmp");
+    catch_signals();
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    if (make_level(&spec, path, strlen(path), 0) < 0) {
+        remove_tree(dir);
+        if (stop_signal) {
+            signal(stop_signal, SIG_DFL);
+            raise(stop_signal);
+        }
+        return EXIT_FAILURE;
+    }
+
+    printf("mode,cache,fanout,depth,files,link_ratio,entries,seconds,entries_per_sec,syscalls,syscalls_per_entry\n");
+    size_t mode_count = sizeof(modes) / sizeof(modes[0]);
+    for (size_t m = 0; m < mode_count && !stop_signal; m++) {
+        const Mode *mode = &modes[m];
+        long syscalls = count_syscalls(dir, mode);
+
+        for (int c = 0; c <= cold; c++) {
+            double best = 1e9;
+            if (!c)
+                time_mode(dir, mode);
+            for (int r = 0; r < rounds && !stop_signal; r++) {
+                if (c && drop_caches() < 0) {
+                    fprintf(stderr, "bench_tree: cannot drop caches, skipping cold runs\n");
+                    cold = 0;
+                    break;
+                }
+                double t = time_mode(dir, mode);
+                if (t < best)
+                    best = t;
+            }
+            if (best == 1e9 || stop_signal)
+                continue;
+
+            double entries = (double)spec.entries + 1;
+            printf("%s,%s,%d,%d,%d,%.3f,%zu,%.6f,%.0f,", mode->name, c ? "cold" : "warm",
+                   spec.fanout, spec.depth, spec.files, spec.links, spec.entries + 1,
+                   best, entries / best);
+            if (syscalls >= 0)
+                printf("%ld,%.3f\n", syscalls, (double)syscalls / entries);
+            else
+                printf(",\n");
+        }
+    }
+
+    fflush(stdout);
+    remove_tree(dir);
+    if (stop_signal) {
+        signal(stop_signal, SIG_DFL);
+        raise(stop_signal);
+    }
+    return EXIT_SUCCESS;
+}
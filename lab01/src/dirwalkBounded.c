@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include "dirwalkBounded.h"
+#include "dirwalkReader.h"
+#include "dirwalkOutput.h"
+#include "dirwalkDu.h"
+#include "dirwalkDupes.h"
+#include "dirwalkSpill.h"
+#include <errno.h>
+#include <stdint.h>
+
+#define FRAME_BUFFER_SIZE 4096
+#define FRAMES_INITIAL    64
+
+/* One level of the explicit stack. A streaming frame keeps a page of
+ * unread records and the getdents offset that follows them, so the level
+ * costs the same whatever the size of the directory. With -s (or without
+ * getdents64) the frame holds the whole listing instead; a listing larger
+ * than SPILL_RUN_BYTES is sorted in runs on disk and merged. */
+typedef struct {
+    int fd;
+    int eof;
+    int seek;
+    dev_t dev;
+    ino_t ino;
+    int64_t next_off;
+    size_t name_off;
+    size_t len;
+    size_t pos;
+    size_t fill;
+    char *buf;
+    DirList list;
+    DirCursor cursor;
+    SpillMerge *spill;
+    DuTotals totals;
+} Frame;
+
+typedef struct {
+    const Options *options;
+    int filter;
+    int stream;
+    OutputBuffer out;
+    const char *root;
+    char *path;
+    size_t path_cap;
+    Frame *frames;
+    size_t depth;
+    size_t cap;
+    size_t lowest;
+    int open_fds;
+    int max_fds;
+} Walker;
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+static int is_dot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Paths are not limited by PATH_MAX here: every syscall is relative to the
+ * parent's fd, only the printed path keeps growing. */
+static void path_reserve(Walker *w, size_t need) {
+    if (need <= w->path_cap)
+        return;
+    size_t cap = w->path_cap ? w->path_cap : PATH_MAX;
+    while (cap < need)
+        cap *= 2;
+    w->path = xrealloc(w->path, cap);
+    w->path_cap = cap;
+}
+
+static void frame_close(Walker *w, Frame *f) {
+    if (f->fd < 0)
+        return;
+    close(f->fd);
+    f->fd = -1;
+    w->open_fds--;
+}
+
+/* Keeps the deepest directories open: the ones near the root are closed
+ * first, they are the last to be read again. */
+static void make_room(Walker *w, size_t keep) {
+    for (size_t i = w->lowest; i < w->depth && w->open_fds >= w->max_fds; i++) {
+        if (i != keep)
+            frame_close(w, &w->frames[i]);
+    }
+    while (w->lowest < w->depth && w->frames[w->lowest].fd < 0)
+        w->lowest++;
+}
+
+static int same_dir(int fd, const Frame *f) {
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return 0;
+    if (st.st_dev != f->dev || st.st_ino != f->ino) {
+        errno = ESTALE;
+        return 0;
+    }
+    return 1;
+}
+
+static void frame_attach(Walker *w, size_t i, int fd) {
+    w->frames[i].fd = fd;
+    w->frames[i].seek = 1;
+    w->open_fds++;
+    if (w->lowest > i)
+        w->lowest = i;
+}
+
+/* Reopens frame i by name from its nearest open ancestor (the root by path)
+ * and checks that every directory on the way is still the same inode. */
+static int frame_reopen(Walker *w, size_t i) {
+    size_t j = i;
+    while (j > 0 && w->frames[j - 1].fd < 0)
+        j--;
+
+    for (size_t k = j; k <= i; k++) {
+        Frame *f = &w->frames[k];
+        make_room(w, k > 0 ? k - 1 : SIZE_MAX);
+        int fd;
+        if (k == 0) {
+            fd = open(w->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        } else {
+            char slash = w->path[f->len - 1];
+            w->path[f->len - 1] = '\0';
+            fd = openat(w->frames[k - 1].fd, w->path + f->name_off, dir_open_flags(w->options));
+            w->path[f->len - 1] = slash;
+        }
+        if (fd >= 0 && !same_dir(fd, f)) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            fd = -1;
+        }
+        if (fd < 0)
+            return -1;
+        frame_attach(w, k, fd);
+    }
+    return 0;
+}
+
+static Frame *frame_push(Walker *w, int fd, size_t name_off, size_t len) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return NULL;
+    }
+
+    if (w->depth == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : FRAMES_INITIAL;
+        w->frames = xrealloc(w->frames, cap * sizeof(Frame));
+        memset(w->frames + w->cap, 0, (cap - w->cap) * sizeof(Frame));
+        w->cap = cap;
+    }
+
+    Frame *f = &w->frames[w->depth];
+    char *buf = f->buf;
+    memset(f, 0, sizeof(*f));
+    f->buf = buf;
+    f->fd = fd;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->name_off = name_off;
+    f->len = len;
+    w->open_fds++;
+    w->depth++;
+
+    if (w->stream) {
+        if (!f->buf && !(f->buf = malloc(FRAME_BUFFER_SIZE))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    } else if (w->options->sort_output && !w->options->cache) {
+        int more = dir_list_read_some(fd, &f->list, SPILL_RUN_BYTES);
+        if (more < 0)
+            perror("getdents");
+        if (more > 0) {
+            if (!(f->spill = malloc(sizeof(SpillMerge)))) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            if (spill_directory(f->spill, fd, &f->list) < 0) {
+                spill_free(f->spill);
+                free(f->spill);
+                f->spill = NULL;
+                /* Without the runs the whole directory is sorted in memory;
+                 * if even that fails it is skipped rather than half listed. */
+                dir_list_free(&f->list);
+                if (lseek(fd, 0, SEEK_SET) < 0 || dir_list_load(fd, &f->list, w->options) < 0) {
+                    perror("getdents");
+                    dir_list_free(&f->list);
+                }
+                dir_list_sort(&f->list);
+            }
+        } else {
+            dir_list_sort(&f->list);
+        }
+    } else {
+        if (dir_list_load(fd, &f->list, w->options) < 0)
+            perror("getdents");
+        if (w->options->sort_output)
+            dir_list_sort(&f->list);
+    }
+    return f;
+}
+
+/* Leaving a directory: if the parent was closed to honour the cap, ".."
+ * of the still open child is the cheapest way back to it. */
+static void frame_pop(Walker *w) {
+    size_t i = w->depth - 1;
+    Frame *f = &w->frames[i];
+    Frame *parent = i > 0 ? &w->frames[i - 1] : NULL;
+
+    if (parent && parent->fd < 0 && f->fd >= 0) {
+        make_room(w, i);
+        int fd = openat(f->fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0 && !same_dir(fd, parent)) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0)
+            frame_attach(w, i - 1, fd);
+    }
+    frame_close(w, f);
+    dir_list_free(&f->list);
+    if (f->spill) {
+        spill_free(f->spill);
+        free(f->spill);
+        f->spill = NULL;
+    }
+
+    DuState *du = w->options->du;
+    if (du) {
+        if (parent) {
+            w->path[f->len - 1] = '\0';
+            du_report(du, w->path, &f->totals);
+            du_add(&parent->totals, &f->totals);
+        } else {
+            du_report(du, w->root, &f->totals);
+        }
+    }
+    w->depth--;
+    if (w->lowest > w->depth)
+        w->lowest = w->depth;
+}
+
+static void report_stale(Walker *w, const Frame *f) {
+    int err = errno;
+    path_reserve(w, f->len + 1);
+    w->path[f->len] = '\0';
+    fprintf(stderr, "dirwalk: cannot reopen %s: %s\n", w->path, strerror(err));
+}
+
+static const DirEntry *frame_next(Walker *w, size_t i) {
+    Frame *f = &w->frames[i];
+    if (f->spill)
+        return spill_next(f->spill);
+    if (!w->stream)
+        return dir_list_next(&f->list, &f->cursor);
+
+    for (;;) {
+        while (f->pos < f->fill) {
+            const DirEntry *entry = (const DirEntry *)(f->buf + f->pos);
+            f->pos += entry->reclen;
+            if (!is_dot(entry->name))
+                return entry;
+        }
+        if (f->eof)
+            return NULL;
+        if (f->fd < 0 && frame_reopen(w, i) < 0) {
+            report_stale(w, f);
+            return NULL;
+        }
+        if (f->seek && f->next_off != 0 && lseek(f->fd, f->next_off, SEEK_SET) < 0) {
+            perror("lseek");
+            return NULL;
+        }
+        f->seek = 0;
+
+#ifdef __linux__
+        ssize_t n = getdents64(f->fd, f->buf, FRAME_BUFFER_SIZE);
+#else
+        ssize_t n = 0;
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("getdents");
+            return NULL;
+        }
+        if (n == 0) {
+            f->eof = 1;
+            return NULL;
+        }
+
+        f->pos = 0;
+        f->fill = (size_t)n;
+        for (size_t pos = 0; pos < f->fill; ) {
+            const DirEntry *entry = (const DirEntry *)(f->buf + pos);
+            f->next_off = entry->off;
+            pos += entry->reclen;
+        }
+    }
+}
+
+static void walk_frames(Walker *w) {
+    const Options *options = w->options;
+    for (;;) {
+        if (w->depth == 0)
+            return;
+        size_t i = w->depth - 1;
+        const DirEntry *entry = frame_next(w, i);
+        if (!entry) {
+            frame_pop(w);
+            continue;
+        }
+
+        Frame *f = &w->frames[i];
+        if (f->fd < 0 && frame_reopen(w, i) < 0) {
+            report_stale(w, f);
+            frame_pop(w);
+            continue;
+        }
+
+        size_t name_len = strlen(entry->name);
+        size_t child_len = f->len + name_len;
+        path_reserve(w, child_len + 2);
+        memcpy(w->path + f->len, entry->name, name_len + 1);
+
+        EntryInfo info = {
+            .dirfd = f->fd,
+            .name = entry->name,
+            .base = entry->name,
+            .type = entry_type(f->fd, entry->name, entry->type, options->follow_links),
+            .depth = (int)i + 1,
+            .follow = options->follow_links,
+        };
+        if (info.type == DT_UNKNOWN)
+            continue;
+
+        if (!entry_descend(options, &info)) {
+            if (entry_visit(options, w->filter, &info, &w->out, w->path, child_len, &f->totals) == WALK_STOP)
+                break;
+            continue;
+        }
+
+        DuTotals sub = {0};
+        int action = entry_visit(options, w->filter, &info, &w->out, w->path, child_len, &sub);
+        if (action == WALK_STOP)
+            break;
+        if (action == WALK_SKIP)
+            continue;
+
+        make_room(w, i);
+        int fd = openat(f->fd, entry->name, dir_open_flags(options));
+        Frame *child = NULL;
+        if (fd < 0) {
+            perror("openat");
+        } else {
+            w->path[child_len] = '/';
+            w->path[child_len + 1] = '\0';
+            child = frame_push(w, fd, f->len, child_len + 1);
+            if (!child)
+                w->path[child_len] = '\0';
+        }
+
+        if (child) {
+            du_add(&child->totals, &sub);
+        } else if (options->du) {
+            f = &w->frames[i];
+            du_report(options->du, w->path, &sub);
+            du_add(&f->totals, &sub);
+        }
+    }
+    /* Stopped by the visitor: unwind without reading further. */
+    while (w->depth > 0)
+        frame_pop(w);
+}
+
+void walk_directory_bounded(const char *path, const Options *options, int filter) {
+    Walker w = {
+        .options = options,
+        .filter = filter,
+        .root = path,
+        .max_fds = options->max_fds,
+    };
+#ifdef __linux__
+    w.stream = !options->sort_output;
+#endif
+    output_init(&w.out, STDOUT_FILENO, options->separator, NULL);
+    path_reserve(&w, strlen(path) + 2);
+    size_t len = dir_prefix(w.path, w.path_cap, path);
+
+    EntryInfo root;
+    char base[NAME_MAX + 1];
+    DuTotals totals = {0};
+    root_entry(options, &root, path, base, sizeof(base));
+    int action = entry_visit(options, filter, &root, &w.out, path, strlen(path), &totals);
+
+    Frame *top = NULL;
+    if (action == WALK_CONTINUE && entry_descend(options, &root)) {
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            perror("open");
+        else
+            top = frame_push(&w, fd, 0, len);
+    }
+    if (top) {
+        du_add(&top->totals, &totals);
+        walk_frames(&w);
+    } else if (options->du) {
+        du_report(options->du, path, &totals);
+    }
+
+    if (options->du)
+        du_print(options->du, &w.out);
+    if (options->dupes)
+        dupes_print(options->dupes, &w.out);
+    output_free(&w.out);
+
+    for (size_t i = 0; i < w.cap; i++)
+        free(w.frames[i].buf);
+    free(w.frames);
+    free(w.path);
+    dir_list_release_spares();
+}
@@ -0,0 +1,13 @@
+#ifndef DIRWALK_BOUNDED_H
+#define DIRWALK_BOUNDED_H
+
+#include "dirwalkFunc.h"
+
+/* One fd for the directory being read plus one for the child being opened. */
+#define BOUNDED_MIN_FDS 2
+/* Cap used by --stream when --max-fds is not given. */
+#define BOUNDED_STREAM_FDS 64
+
+void walk_directory_bounded(const char *path, const Options *options, int filter);
+
+#endif
@@ -0,0 +1,264 @@
+#include "dirwalkCache.h"
+#include <errno.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define CACHE_RACY_SECONDS 1
+
+static void cache_fill_dir(CacheDir *dir, const struct stat *st) {
+    dir->dev = (uint64_t)st->st_dev;
+    dir->ino = (uint64_t)st->st_ino;
+    dir->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    dir->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    dir->ctime_sec = (int64_t)st->st_ctim.tv_sec;
+    dir->ctime_nsec = (int64_t)st->st_ctim.tv_nsec;
+}
+
+static int cache_key_cmp(const CacheDir *a, const CacheDir *b) {
+    if (a->dev != b->dev)
+        return a->dev < b->dev ? -1 : 1;
+    if (a->ino != b->ino)
+        return a->ino < b->ino ? -1 : 1;
+    return 0;
+}
+
+static int record_cmp(const void *a, const void *b) {
+    return cache_key_cmp(&((const CacheRecord *)a)->dir, &((const CacheRecord *)b)->dir);
+}
+
+/* Checks that a listing taken from the file is a well-formed run of records,
+ * so a truncated or corrupted cache degrades into misses, not crashes. */
+static int cache_listing_valid(const char *data, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        if (len - pos < offsetof(DirEntry, name) + 1)
+            return 0;
+        const DirEntry *entry = (const DirEntry *)(data + pos);
+        if (entry->reclen <= offsetof(DirEntry, name) || entry->reclen > len - pos ||
+            entry->reclen % 8 != 0)
+            return 0;
+        if (!memchr(entry->name, '\0', entry->reclen - offsetof(DirEntry, name)))
+            return 0;
+        pos += entry->reclen;
+    }
+    return 1;
+}
+
+static int cache_map(DirCache *cache) {
+    int fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const CacheHeader *header = map;
+    size_t size = st.st_size;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CACHE_VERSION ||
+        header->entry_size != sizeof(CacheDir) ||
+        header->table_off % 8 != 0 || header->data_off % 8 != 0 ||
+        header->table_off > size || header->dir_count > (size - header->table_off) / sizeof(CacheDir) ||
+        header->data_off > size || header->data_len > size - header->data_off) {
+        munmap(map, size);
+        return -1;
+    }
+
+    cache->map = map;
+    cache->map_len = size;
+    cache->table = (const CacheDir *)((const char *)map + header->table_off);
+    cache->table_len = header->dir_count;
+    cache->data = (const char *)map + header->data_off;
+    cache->data_len = header->data_len;
+    return 0;
+}
+
+DirCache *cache_open(const char *path) {
+    DirCache *cache = calloc(1, sizeof(DirCache));
+    if (!cache) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    cache->path = path;
+    cache->started = time(NULL);
+    pthread_mutex_init(&cache->lock, NULL);
+    if (cache_map(cache) < 0)
+        fprintf(stderr, "dirwalk: ignoring unreadable cache %s\n", path);
+    return cache;
+}
+
+static void cache_add_record(DirCache *cache, const CacheRecord *record) {
+    pthread_mutex_lock(&cache->lock);
+    if (cache->record_count == cache->record_cap) {
+        size_t cap = cache->record_cap ? cache->record_cap * 2 : 256;
+        CacheRecord *records = realloc(cache->records, cap * sizeof(CacheRecord));
+        if (!records) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        cache->records = records;
+        cache->record_cap = cap;
+    }
+    cache->records[cache->record_count++] = *record;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int cache_lookup(DirCache *cache, const struct stat *st, DirList *list) {
+    CacheDir key;
+    cache_fill_dir(&key, st);
+
+    size_t lo = 0, hi = cache->table_len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int r = cache_key_cmp(&cache->table[mid], &key);
+        if (r == 0) {
+            const CacheDir *dir = &cache->table[mid];
+            if (dir->mtime_sec != key.mtime_sec || dir->mtime_nsec != key.mtime_nsec ||
+                dir->ctime_sec != key.ctime_sec || dir->ctime_nsec != key.ctime_nsec ||
+                dir->data_off > cache->data_len || dir->data_len > cache->data_len - dir->data_off)
+                break;
+
+            const char *data = cache->data + dir->data_off;
+            if (!cache_listing_valid(data, dir->data_len) ||
+                dir_list_wrap(list, data, dir->data_len) < 0)
+                break;
+
+            CacheRecord record = { .dir = *dir, .data = data, .owned = 0 };
+            cache_add_record(cache, &record);
+            atomic_fetch_add(&cache->hits, 1);
+            return 1;
+        }
+        if (r < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    atomic_fetch_add(&cache->misses, 1);
+    return 0;
+}
+
+/* A directory changed within the timestamp granularity of the scan could
+ * change again without moving its mtime, so such listings are not kept. */
+void cache_store(DirCache *cache, const struct stat *st, const DirList *list) {
+    if (st->st_mtim.tv_sec >= cache->started - CACHE_RACY_SECONDS ||
+        st->st_ctim.tv_sec >= cache->started - CACHE_RACY_SECONDS)
+        return;
+
+    size_t len = 0;
+    for (const DirChunk *chunk = list->head; chunk; chunk = chunk->next)
+        len += chunk->len;
+
+    char *data = malloc(len ? len : 1);
+    if (!data) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t pos = 0;
+    DirCursor cursor = {0};
+    DirList unsorted = *list;
+    unsorted.sorted = 0;
+    const DirEntry *entry;
+    while ((entry = dir_list_next(&unsorted, &cursor)) != NULL) {
+        memcpy(data + pos, entry, entry->reclen);
+        pos += entry->reclen;
+    }
+
+    CacheRecord record = { .data = data, .owned = 1 };
+    cache_fill_dir(&record.dir, st);
+    record.dir.data_len = pos;
+    cache_add_record(cache, &record);
+}
+
+static int write_all(FILE *file, const void *data, size_t len) {
+    return len == 0 || fwrite(data, 1, len, file) == len ? 0 : -1;
+}
+
+int cache_save(DirCache *cache) {
+    qsort(cache->records, cache->record_count, sizeof(CacheRecord), record_cmp);
+
+    size_t count = 0;
+    uint64_t data_len = 0;
+    for (size_t i = 0; i < cache->record_count; i++) {
+        if (count > 0 && cache_key_cmp(&cache->records[count - 1].dir, &cache->records[i].dir) == 0) {
+            if (cache->records[i].owned)
+                free((void *)cache->records[i].data);
+            continue;
+        }
+        cache->records[count] = cache->records[i];
+        cache->records[count].dir.data_off = data_len;
+        data_len += cache->records[count].dir.data_len;
+        count++;
+    }
+    cache->record_count = count;
+
+    CacheHeader header = {0};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.entry_size = sizeof(CacheDir);
+    header.dir_count = count;
+    header.table_off = sizeof(CacheHeader);
+    header.data_off = header.table_off + count * sizeof(CacheDir);
+    header.data_len = data_len;
+
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache->path, (int)getpid()) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "dirwalk: cache path too long\n");
+        return -1;
+    }
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        perror(tmp_path);
+        return -1;
+    }
+
+    int rc = write_all(file, &header, sizeof(header));
+    for (size_t i = 0; rc == 0 && i < count; i++)
+        rc = write_all(file, &cache->records[i].dir, sizeof(CacheDir));
+    for (size_t i = 0; rc == 0 && i < count; i++)
+        rc = write_all(file, cache->records[i].data, cache->records[i].dir.data_len);
+    if (fclose(file) != 0)
+        rc = -1;
+
+    if (rc == 0 && rename(tmp_path, cache->path) < 0)
+        rc = -1;
+    if (rc < 0) {
+        perror(cache->path);
+        unlink(tmp_path);
+    }
+    return rc;
+}
+
+void cache_close(DirCache *cache) {
+    for (size_t i = 0; i < cache->record_count; i++) {
+        if (cache->records[i].owned)
+            free((void *)cache->records[i].data);
+    }
+    free(cache->records);
+    if (cache->map)
+        munmap((void *)cache->map, cache->map_len);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+int dir_list_load(int fd, DirList *list, const Options *options) {
+    struct stat st;
+    if (!options->cache || fstat(fd, &st) < 0)
+        return dir_list_read(fd, list);
+
+    if (cache_lookup(options->cache, &st, list))
+        return 0;
+    if (dir_list_read(fd, list) < 0)
+        return -1;
+    dir_list_resolve_types(list, fd);
+    cache_store(options->cache, &st, list);
+    return 0;
+}
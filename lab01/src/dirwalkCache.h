@@ -0,0 +1,64 @@
+#ifndef DIRWALK_CACHE_H
+#define DIRWALK_CACHE_H
+
+#include "dirwalkReader.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define CACHE_MAGIC   "DWCACHE1"
+#define CACHE_VERSION 1
+
+/* On-disk layout, host byte order: header, a table of directories sorted by
+ * (dev, ino), then the listings as raw DirEntry records. The file is mapped
+ * read-only and listings are served straight from the mapping. */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t dir_count;
+    uint64_t table_off;
+    uint64_t data_off;
+    uint64_t data_len;
+} CacheHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint64_t data_off;
+    uint64_t data_len;
+} CacheDir;
+
+typedef struct {
+    CacheDir dir;
+    const char *data;
+    int owned;
+} CacheRecord;
+
+typedef struct DirCache {
+    const char *path;
+    const char *map;
+    size_t map_len;
+    const CacheDir *table;
+    size_t table_len;
+    const char *data;
+    size_t data_len;
+    time_t started;
+    pthread_mutex_t lock;
+    CacheRecord *records;
+    size_t record_count;
+    size_t record_cap;
+    atomic_size_t hits;
+    atomic_size_t misses;
+} DirCache;
+
+DirCache *cache_open(const char *path);
+int  cache_lookup(DirCache *cache, const struct stat *st, DirList *list);
+void cache_store(DirCache *cache, const struct stat *st, const DirList *list);
+int  cache_save(DirCache *cache);
+void cache_close(DirCache *cache);
+
+#endif
@@ -0,0 +1,129 @@
+#include "dirwalkDu.h"
+#include <inttypes.h>
+
+DuState *du_new(size_t top_max) {
+    DuState *du = calloc(1, sizeof(DuState));
+    if (!du || !(du->top = calloc(top_max ? top_max : 1, sizeof(DuSubtree)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    du->top_max = top_max;
+    inode_set_init(&du->seen);
+    pthread_mutex_init(&du->lock, NULL);
+    return du;
+}
+
+/* Files with several links are counted once, at the first path that reaches
+ * them; directories cannot be hard linked and skip the set. */
+void du_account(DuState *du, EntryInfo *entry, DuTotals *totals) {
+    if (entry_stat(entry) < 0)
+        return;
+
+    const struct stat *st = &entry->st;
+    if (!S_ISDIR(st->st_mode) && st->st_nlink > 1 &&
+        !inode_set_insert(&du->seen, st->st_dev, st->st_ino))
+        return;
+
+    atomic_fetch_add_explicit(&totals->bytes, (uint64_t)st->st_size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&totals->blocks, (uint64_t)st->st_blocks * 512, memory_order_relaxed);
+    if (!S_ISDIR(st->st_mode))
+        atomic_fetch_add_explicit(&totals->files, 1, memory_order_relaxed);
+}
+
+void du_add(DuTotals *totals, const DuTotals *sub) {
+    atomic_fetch_add_explicit(&totals->bytes, atomic_load(&sub->bytes), memory_order_relaxed);
+    atomic_fetch_add_explicit(&totals->blocks, atomic_load(&sub->blocks), memory_order_relaxed);
+    atomic_fetch_add_explicit(&totals->files, atomic_load(&sub->files), memory_order_relaxed);
+}
+
+static int heavier(const DuSubtree *a, const DuSubtree *b) {
+    if (a->blocks != b->blocks)
+        return a->blocks > b->blocks;
+    return a->bytes > b->bytes;
+}
+
+static void heap_sift_down(DuSubtree *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && heavier(&heap[min], &heap[l]))
+            min = l;
+        if (r < n && heavier(&heap[min], &heap[r]))
+            min = r;
+        if (min == i)
+            return;
+        DuSubtree tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+static void heap_sift_up(DuSubtree *heap, size_t i) {
+    while (i > 0 && heavier(&heap[(i - 1) / 2], &heap[i])) {
+        DuSubtree tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+void du_report(DuState *du, const char *path, const DuTotals *totals) {
+    DuSubtree item = {
+        .bytes = atomic_load(&totals->bytes),
+        .blocks = atomic_load(&totals->blocks),
+        .files = atomic_load(&totals->files),
+    };
+    if (du->top_max == 0)
+        return;
+
+    pthread_mutex_lock(&du->lock);
+    if (du->top_count < du->top_max || heavier(&item, &du->top[0])) {
+        if (!(item.path = strdup(path))) {
+            perror("strdup");
+            exit(EXIT_FAILURE);
+        }
+        if (du->top_count < du->top_max) {
+            du->top[du->top_count] = item;
+            heap_sift_up(du->top, du->top_count++);
+        } else {
+            free(du->top[0].path);
+            du->top[0] = item;
+            heap_sift_down(du->top, du->top_count, 0);
+        }
+    }
+    pthread_mutex_unlock(&du->lock);
+}
+
+static int subtree_cmp(const void *a, const void *b) {
+    const DuSubtree *sa = a;
+    const DuSubtree *sb = b;
+    if (heavier(sa, sb))
+        return -1;
+    if (heavier(sb, sa))
+        return 1;
+    return strcmp(sa->path, sb->path);
+}
+
+/* One line per subtree, heaviest first: disk usage, apparent size (both in
+ * bytes), number of non-directory entries, path. */
+void du_print(DuState *du, OutputBuffer *out) {
+    qsort(du->top, du->top_count, sizeof(DuSubtree), subtree_cmp);
+    for (size_t i = 0; i < du->top_count; i++) {
+        char line[96];
+        int len = snprintf(line, sizeof(line), "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t",
+                           du->top[i].blocks, du->top[i].bytes, du->top[i].files);
+        output_bytes(out, line, (size_t)len);
+        output_path(out, du->top[i].path, strlen(du->top[i].path));
+    }
+}
+
+void du_free(DuState *du) {
+    if (!du)
+        return;
+    for (size_t i = 0; i < du->top_count; i++)
+        free(du->top[i].path);
+    free(du->top);
+    inode_set_destroy(&du->seen);
+    pthread_mutex_destroy(&du->lock);
+    free(du);
+}
@@ -0,0 +1,40 @@
+#ifndef DIRWALK_DU_H
+#define DIRWALK_DU_H
+
+#include "dirwalkInodeSet.h"
+#include "dirwalkOutput.h"
+#include <stdatomic.h>
+
+#define DU_DEFAULT_TOP 10
+
+typedef struct DuTotals {
+    atomic_uint_least64_t bytes;
+    atomic_uint_least64_t blocks;
+    atomic_uint_least64_t files;
+} DuTotals;
+
+typedef struct {
+    char *path;
+    uint64_t bytes;
+    uint64_t blocks;
+    uint64_t files;
+} DuSubtree;
+
+/* Totals are kept in bytes: `blocks` is st_blocks * 512, i.e. what the
+ * subtree occupies on disk. The heaviest subtrees are kept in a min-heap. */
+typedef struct DuState {
+    InodeSet seen;
+    pthread_mutex_t lock;
+    DuSubtree *top;
+    size_t top_count;
+    size_t top_max;
+} DuState;
+
+DuState *du_new(size_t top_max);
+void du_account(DuState *du, EntryInfo *entry, DuTotals *totals);
+void du_add(DuTotals *totals, const DuTotals *sub);
+void du_report(DuState *du, const char *path, const DuTotals *totals);
+void du_print(DuState *du, OutputBuffer *out);
+void du_free(DuState *du);
+
+#endif
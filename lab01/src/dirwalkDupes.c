@@ -0,0 +1,340 @@
+#include "dirwalkDupes.h"
+#include <errno.h>
+#include <stdatomic.h>
+
+#define HASH_K1 0x87c37b91114253d5ULL
+#define HASH_K2 0x4cf5ad432745937fULL
+#define HASH_K3 0x52dce729ULL
+
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+    uint64_t len;
+} HashState;
+
+typedef void (*StageFn)(DupeFile *file, char *buf);
+
+typedef struct {
+    DupeFile **files;
+    size_t count;
+    atomic_size_t next;
+    StageFn fn;
+} Stage;
+
+DupesState *dupes_new(int jobs) {
+    DupesState *dupes = calloc(1, sizeof(DupesState));
+    if (!dupes) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&dupes->lock, NULL);
+    inode_set_init(&dupes->seen);
+    dupes->jobs = jobs > 0 ? jobs : 1;
+    return dupes;
+}
+
+static const char *arena_strdup(DupesState *dupes, const char *path, size_t len) {
+    DupesArena *arena = dupes->arena;
+    if (!arena || arena->cap - arena->len < len + 1) {
+        size_t cap = len + 1 > DUPES_ARENA_CHUNK ? len + 1 : DUPES_ARENA_CHUNK;
+        arena = malloc(sizeof(DupesArena) + cap);
+        if (!arena) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        arena->next = dupes->arena;
+        arena->len = 0;
+        arena->cap = cap;
+        dupes->arena = arena;
+    }
+    char *copy = arena->data + arena->len;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    arena->len += len + 1;
+    return copy;
+}
+
+/* Only regular, non-empty files take part. Further links to an inode that
+ * was already seen are the same file, not a duplicate, and are skipped;
+ * with -L that includes symlinks to it. */
+void dupes_add(DupesState *dupes, EntryInfo *entry, const char *path, size_t len) {
+    if (entry->type != DT_REG || entry_stat(entry) < 0 || entry->st.st_size == 0)
+        return;
+    if ((entry->st.st_nlink > 1 || entry->follow) && !inode_set_insert(&dupes->seen, entry->st.st_dev, entry->st.st_ino))
+        return;
+
+    pthread_mutex_lock(&dupes->lock);
+    if (dupes->count == dupes->cap) {
+        size_t cap = dupes->cap ? dupes->cap * 2 : 1024;
+        DupeFile *files = realloc(dupes->files, cap * sizeof(DupeFile));
+        if (!files) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        dupes->files = files;
+        dupes->cap = cap;
+    }
+    dupes->files[dupes->count++] = (DupeFile){
+        .size = (uint64_t)entry->st.st_size,
+        .path = arena_strdup(dupes, path, len),
+        .follow = entry->follow,
+    };
+    pthread_mutex_unlock(&dupes->lock);
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Two 64-bit lanes in the spirit of MurmurHash3; not cryptographic, but
+ * 128 bits make an accidental collision between real files negligible. */
+static void hash_update(HashState *h, const unsigned char *data, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h->a ^= rotl64(w * HASH_K1, 31) * HASH_K2;
+        h->a = rotl64(h->a, 27) + h->b;
+        h->b ^= rotl64(w * HASH_K2, 33) * HASH_K1;
+        h->b = rotl64(h->b, 31) * 5 + h->a + HASH_K3;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, len - i);
+        h->a ^= rotl64(w * HASH_K1, 31) * HASH_K2;
+        h->b ^= rotl64(w * HASH_K2, 33) * HASH_K1;
+    }
+    h->len += len;
+}
+
+static void hash_final(HashState *h, uint64_t out[2]) {
+    uint64_t a = h->a ^ h->len;
+    uint64_t b = h->b ^ h->len;
+    a += b;
+    b += a;
+    a = fmix64(a);
+    b = fmix64(b);
+    out[0] = a + b;
+    out[1] = b + a + a;
+}
+
+/* Hashes up to `limit` bytes of the file. Reads fill the buffer completely
+ * before hashing, so only the very last block can end off a word boundary. */
+static int hash_file(const DupeFile *file, uint64_t limit, char *buf, size_t buf_size, uint64_t out[2]) {
+    const char *path = file->path;
+    int fd = open(path, O_RDONLY | O_CLOEXEC | (file->follow ? 0 : O_NOFOLLOW));
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (limit > DUPES_HEAD_SIZE)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    HashState h = { .a = 0x9368e53c2f6af274ULL, .b = 0x586dcd208f7cd3fdULL };
+    uint64_t off = 0;
+    while (off < limit) {
+        size_t want = limit - off < buf_size ? (size_t)(limit - off) : buf_size;
+        size_t got = 0;
+        while (got < want) {
+            ssize_t n = pread(fd, buf + got, want - got, (off_t)(off + got));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                perror(path);
+                close(fd);
+                return -1;
+            }
+            if (n == 0)
+                break;
+            got += (size_t)n;
+        }
+        hash_update(&h, (const unsigned char *)buf, got);
+        off += got;
+        if (got < want)
+            break;
+    }
+    close(fd);
+    hash_final(&h, out);
+    return 0;
+}
+
+static void stage_head(DupeFile *file, char *buf) {
+    uint64_t limit = file->size < DUPES_HEAD_SIZE ? file->size : DUPES_HEAD_SIZE;
+    if (hash_file(file, limit, buf, DUPES_HEAD_SIZE, file->head) < 0) {
+        file->failed = 1;
+        return;
+    }
+    if (file->size <= DUPES_HEAD_SIZE) {
+        file->full[0] = file->head[0];
+        file->full[1] = file->head[1];
+    }
+}
+
+static void stage_full(DupeFile *file, char *buf) {
+    if (hash_file(file, file->size, buf, DUPES_READ_SIZE, file->full) < 0)
+        file->failed = 1;
+}
+
+static void *stage_worker(void *arg) {
+    Stage *stage = arg;
+    char *buf = malloc(DUPES_READ_SIZE);
+    if (!buf) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t i;
+    while ((i = atomic_fetch_add(&stage->next, 1)) < stage->count)
+        stage->fn(stage->files[i], buf);
+    free(buf);
+    return NULL;
+}
+
+static void run_stage(DupesState *dupes, DupeFile **files, size_t count, StageFn fn) {
+    if (count == 0)
+        return;
+    Stage stage = { .files = files, .count = count, .fn = fn };
+    atomic_init(&stage.next, 0);
+
+    int jobs = (size_t)dupes->jobs < count ? dupes->jobs : (int)count;
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    if (!threads) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int started = 0;
+    for (int i = 1; i < jobs; i++) {
+        if (pthread_create(&threads[started], NULL, stage_worker, &stage) != 0)
+            break;
+        started++;
+    }
+    stage_worker(&stage);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+static int size_cmp(const void *a, const void *b) {
+    const DupeFile *fa = *(DupeFile *const *)a;
+    const DupeFile *fb = *(DupeFile *const *)b;
+    if (fa->size != fb->size)
+        return fa->size > fb->size ? -1 : 1;
+    return 0;
+}
+
+static int head_cmp(const void *a, const void *b) {
+    const DupeFile *fa = *(DupeFile *const *)a;
+    const DupeFile *fb = *(DupeFile *const *)b;
+    int r = size_cmp(a, b);
+    if (r == 0 && fa->failed != fb->failed)
+        r = fa->failed - fb->failed;
+    if (r == 0 && fa->head[0] != fb->head[0])
+        r = fa->head[0] < fb->head[0] ? -1 : 1;
+    if (r == 0 && fa->head[1] != fb->head[1])
+        r = fa->head[1] < fb->head[1] ? -1 : 1;
+    return r;
+}
+
+static int full_cmp(const void *a, const void *b) {
+    const DupeFile *fa = *(DupeFile *const *)a;
+    const DupeFile *fb = *(DupeFile *const *)b;
+    int r = head_cmp(a, b);
+    if (r == 0 && fa->full[0] != fb->full[0])
+        r = fa->full[0] < fb->full[0] ? -1 : 1;
+    if (r == 0 && fa->full[1] != fb->full[1])
+        r = fa->full[1] < fb->full[1] ? -1 : 1;
+    return r != 0 ? r : strcmp(fa->path, fb->path);
+}
+
+/* Keeps only the members of runs of at least two equal elements. */
+static size_t keep_groups(DupeFile **files, size_t count, int (*cmp)(const void *, const void *)) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ) {
+        size_t j = i + 1;
+        while (j < count && cmp(&files[i], &files[j]) == 0)
+            j++;
+        if (j - i >= 2 && !files[i]->failed) {
+            for (size_t k = i; k < j; k++)
+                files[kept++] = files[k];
+        }
+        i = j;
+    }
+    return kept;
+}
+
+static int full_group_cmp(const void *a, const void *b) {
+    const DupeFile *fa = *(DupeFile *const *)a;
+    const DupeFile *fb = *(DupeFile *const *)b;
+    int r = head_cmp(a, b);
+    if (r == 0 && fa->full[0] != fb->full[0])
+        r = fa->full[0] < fb->full[0] ? -1 : 1;
+    if (r == 0 && fa->full[1] != fb->full[1])
+        r = fa->full[1] < fb->full[1] ? -1 : 1;
+    return r;
+}
+
+/* Prints one group per block, largest files first, groups separated by an
+ * empty record as fdupes does. */
+void dupes_print(DupesState *dupes, OutputBuffer *out) {
+    DupeFile **files = malloc((dupes->count ? dupes->count : 1) * sizeof(DupeFile *));
+    if (!files) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < dupes->count; i++)
+        files[i] = &dupes->files[i];
+
+    qsort(files, dupes->count, sizeof(DupeFile *), size_cmp);
+    size_t count = keep_groups(files, dupes->count, size_cmp);
+
+    run_stage(dupes, files, count, stage_head);
+    qsort(files, count, sizeof(DupeFile *), head_cmp);
+    count = keep_groups(files, count, head_cmp);
+
+    size_t big = 0;
+    DupeFile **large = malloc((count ? count : 1) * sizeof(DupeFile *));
+    if (!large) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (files[i]->size > DUPES_HEAD_SIZE)
+            large[big++] = files[i];
+    }
+    run_stage(dupes, large, big, stage_full);
+    free(large);
+
+    qsort(files, count, sizeof(DupeFile *), full_cmp);
+    count = keep_groups(files, count, full_group_cmp);
+
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && full_group_cmp(&files[i - 1], &files[i]) != 0)
+            output_bytes(out, &out->separator, 1);
+        output_path(out, files[i]->path, strlen(files[i]->path));
+    }
+    free(files);
+}
+
+void dupes_free(DupesState *dupes) {
+    if (!dupes)
+        return;
+    while (dupes->arena) {
+        DupesArena *next = dupes->arena->next;
+        free(dupes->arena);
+        dupes->arena = next;
+    }
+    free(dupes->files);
+    inode_set_destroy(&dupes->seen);
+    pthread_mutex_destroy(&dupes->lock);
+    free(dupes);
+}
@@ -0,0 +1,44 @@
+#ifndef DIRWALK_DUPES_H
+#define DIRWALK_DUPES_H
+
+#include "dirwalkInodeSet.h"
+#include "dirwalkOutput.h"
+
+#define DUPES_HEAD_SIZE   4096
+#define DUPES_READ_SIZE   (1024 * 1024)
+#define DUPES_ARENA_CHUNK (64 * 1024)
+
+typedef struct {
+    uint64_t size;
+    uint64_t head[2];
+    uint64_t full[2];
+    const char *path;
+    int failed;
+    int follow;
+} DupeFile;
+
+typedef struct DupesArena {
+    struct DupesArena *next;
+    size_t len;
+    size_t cap;
+    char data[];
+} DupesArena;
+
+/* Files are only collected during the walk; contents are read afterwards
+ * and only for sizes shared by at least two files. */
+typedef struct DupesState {
+    pthread_mutex_t lock;
+    DupeFile *files;
+    size_t count;
+    size_t cap;
+    DupesArena *arena;
+    InodeSet seen;
+    int jobs;
+} DupesState;
+
+DupesState *dupes_new(int jobs);
+void dupes_add(DupesState *dupes, EntryInfo *entry, const char *path, size_t len);
+void dupes_print(DupesState *dupes, OutputBuffer *out);
+void dupes_free(DupesState *dupes);
+
+#endif
@@ -0,0 +1,245 @@
+#include "dirwalkEstimate.h"
+#include "dirwalkOutput.h"
+#include "dirwalkReader.h"
+#include <math.h>
+#include <time.h>
+
+#define NODE_NEW     0
+#define NODE_SCANNED 1
+#define NODE_FAILED  2
+
+/* Student's t for 95% and ESTIMATE_REPLICATES - 1 degrees of freedom. */
+#define ESTIMATE_T95 2.365
+
+enum { EST_DIRS, EST_FILES, EST_BYTES, EST_BLOCKS, EST_COUNT };
+
+static const char *const est_names[EST_COUNT] = { "dirs", "files", "bytes", "blocks" };
+
+typedef struct {
+    uint64_t rng;
+    size_t scanned;
+    size_t failed;
+    double sum[EST_COUNT];
+    double sumsq[EST_COUNT];
+} Estimator;
+
+static void *xcalloc(size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (!ptr) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+/* xorshift64*: the probes only need cheap, reasonably uniform choices. */
+static uint64_t next_random(Estimator *e) {
+    e->rng ^= e->rng >> 12;
+    e->rng ^= e->rng << 25;
+    e->rng ^= e->rng >> 27;
+    return e->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static double uniform(Estimator *e) {
+    return (double)(next_random(e) >> 11) * 0x1.0p-53;
+}
+
+/* Guess of a subdirectory's share of the tree, known before entering it:
+ * st_nlink counts its own subdirectories on most filesystems, and the size
+ * of the directory file grows with the number of entries. */
+static double child_weight(const struct stat *st) {
+    double subdirs = st->st_nlink > 2 ? (double)(st->st_nlink - 2) : 0;
+    double blocks = st->st_size > 4096 ? (double)st->st_size / 4096 : 1;
+    return (1 + subdirs) * blocks;
+}
+
+/* Sizes of every entry (subdirectories included, as in --du) and the names
+ * of the subdirectories a probe can step into. */
+static void node_scan(Estimator *e, EstimateNode *node, int fd) {
+    DirList list = {0};
+    if (dir_list_read(fd, &list) < 0) {
+        perror("getdents");
+        dir_list_free(&list);
+        node->state = NODE_FAILED;
+        e->failed++;
+        return;
+    }
+    e->scanned++;
+
+    size_t names_len = 0;
+    size_t names_cap = 0;
+    uint32_t cap = 0;
+    DirCursor cursor = {0};
+    const DirEntry *entry;
+    while ((entry = dir_list_next(&list, &cursor))) {
+        struct stat st;
+        if (fstatat(fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+        node->bytes += (uint64_t)st.st_size;
+        node->blocks += (uint64_t)st.st_blocks * 512;
+        if (!S_ISDIR(st.st_mode)) {
+            node->files++;
+            continue;
+        }
+
+        size_t len = strlen(entry->name) + 1;
+        if (names_len + len > names_cap) {
+            names_cap = names_cap ? names_cap * 2 : 256;
+            while (names_len + len > names_cap)
+                names_cap *= 2;
+            node->names = xrealloc(node->names, names_cap);
+        }
+        if (node->child_count == cap) {
+            cap = cap ? cap * 2 : 16;
+            node->name_offs = xrealloc(node->name_offs, cap * sizeof(uint32_t));
+            node->weights = xrealloc(node->weights, cap * sizeof(double));
+        }
+        node->weights[node->child_count] = child_weight(&st);
+        node->total_weight += node->weights[node->child_count];
+        memcpy(node->names + names_len, entry->name, len);
+        node->name_offs[node->child_count++] = (uint32_t)names_len;
+        names_len += len;
+    }
+    dir_list_free(&list);
+    if (node->child_count)
+        node->children = xcalloc(node->child_count, sizeof(EstimateNode *));
+    node->state = NODE_SCANNED;
+}
+
+/* Knuth's estimator, spread over a budget of probes. A directory with d
+ * children and b >= d probes enters every child, so the top of the tree is
+ * counted exactly. With b < d it draws b children with replacement, child
+ * k with probability p_k proportional to its weight, and counts each draw
+ * as T_k / (b * p_k) (Hansen-Hurwitz). Either way the expected result is
+ * the true total; the weights only decide how small the variance is. */
+static void estimate_node(Estimator *e, EstimateNode *node, int fd, size_t budget, double *x) {
+    if (node->state == NODE_NEW)
+        node_scan(e, node, fd);
+    if (node->state != NODE_SCANNED)
+        return;
+    x[EST_DIRS] += node->child_count;
+    x[EST_FILES] += (double)node->files;
+    x[EST_BYTES] += (double)node->bytes;
+    x[EST_BLOCKS] += (double)node->blocks;
+    uint32_t n = node->child_count;
+    if (!n)
+        return;
+
+    /* Probes per child: at least one each when the budget covers them. */
+    size_t *draws = xcalloc(n, sizeof(size_t));
+    if (budget >= n) {
+        size_t left = budget - n;
+        for (uint32_t k = 0; k < n; k++)
+            draws[k] = 1 + (size_t)((double)left * node->weights[k] / node->total_weight);
+    } else {
+        for (size_t i = 0; i < budget; i++) {
+            double target = uniform(e) * node->total_weight;
+            uint32_t k = 0;
+            while (k + 1 < n && target >= node->weights[k]) {
+                target -= node->weights[k];
+                k++;
+            }
+            draws[k]++;
+        }
+    }
+
+    for (uint32_t k = 0; k < n; k++) {
+        if (!draws[k])
+            continue;
+        if (!node->children[k])
+            node->children[k] = xcalloc(1, sizeof(EstimateNode));
+        int child = openat(fd, node->names + node->name_offs[k],
+                           O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child < 0) {
+            if (node->children[k]->state == NODE_NEW) {
+                perror(node->names + node->name_offs[k]);
+                node->children[k]->state = NODE_FAILED;
+                e->failed++;
+            }
+            continue;
+        }
+        double sub[EST_COUNT] = {0};
+        estimate_node(e, node->children[k], child, draws[k], sub);
+        close(child);
+
+        double scale = budget >= n ? 1 :
+                       (double)draws[k] * node->total_weight / ((double)budget * node->weights[k]);
+        for (int i = 0; i < EST_COUNT; i++)
+            x[i] += sub[i] * scale;
+    }
+    free(draws);
+}
+
+static void node_free(EstimateNode *node) {
+    for (uint32_t i = 0; node->children && i < node->child_count; i++) {
+        if (node->children[i]) {
+            node_free(node->children[i]);
+            free(node->children[i]);
+        }
+    }
+    free(node->children);
+    free(node->name_offs);
+    free(node->weights);
+    free(node->names);
+}
+
+/* Prints "name<TAB>estimate<TAB>half-width of the 95% interval" per total,
+ * after a "probes" line with the budget, the directories read and those that
+ * could not be opened or read (their subtrees count as empty). The interval
+ * comes from the spread of ESTIMATE_REPLICATES independent estimates, each
+ * with its share of the probes. Set DIRWALK_SEED to repeat a run. */
+void estimate_tree(const char *path, const Options *options, size_t probes) {
+    Estimator e = {0};
+    const char *seed = getenv("DIRWALK_SEED");
+    e.rng = seed ? strtoull(seed, NULL, 10) : (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    if (!e.rng)
+        e.rng = 0x9E3779B97F4A7C15ULL;
+
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    size_t budget = probes / ESTIMATE_REPLICATES ? probes / ESTIMATE_REPLICATES : 1;
+    EstimateNode root = {0};
+    for (int r = 0; r < ESTIMATE_REPLICATES; r++) {
+        double x[EST_COUNT] = { 1, 0, (double)st.st_size, (double)st.st_blocks * 512 };
+        estimate_node(&e, &root, fd, budget, x);
+        for (int i = 0; i < EST_COUNT; i++) {
+            e.sum[i] += x[i];
+            e.sumsq[i] += x[i] * x[i];
+        }
+    }
+    close(fd);
+    node_free(&root);
+
+    OutputBuffer out;
+    output_init(&out, STDOUT_FILENO, options->separator, NULL);
+    char line[160];
+    int len = snprintf(line, sizeof(line), "probes\t%zu\t%zu\t%zu\n", budget * ESTIMATE_REPLICATES,
+                       e.scanned, e.failed);
+    output_bytes(&out, line, (size_t)len);
+    for (int i = 0; i < EST_COUNT; i++) {
+        double n = ESTIMATE_REPLICATES;
+        double mean = e.sum[i] / n;
+        double var = (e.sumsq[i] - n * mean * mean) / (n - 1);
+        double half = ESTIMATE_T95 * sqrt(var > 0 ? var : 0) / sqrt(n);
+        len = snprintf(line, sizeof(line), "%s\t%.0f\t%.0f\n", est_names[i], mean, half);
+        output_bytes(&out, line, (size_t)len);
+    }
+    output_flush(&out);
+    output_free(&out);
+}
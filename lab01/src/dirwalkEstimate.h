@@ -0,0 +1,27 @@
+#ifndef DIRWALK_ESTIMATE_H
+#define DIRWALK_ESTIMATE_H
+
+#include "dirwalkFunc.h"
+#include <stdint.h>
+
+#define ESTIMATE_DEFAULT_PROBES 1024
+#define ESTIMATE_REPLICATES     8
+
+/* A directory met by some probe. Its listing is read once: later probes
+ * through it only pick a child. */
+typedef struct EstimateNode {
+    int state;
+    uint64_t bytes;
+    uint64_t blocks;
+    uint64_t files;
+    uint32_t child_count;
+    uint32_t *name_offs;
+    double *weights;
+    double total_weight;
+    char *names;
+    struct EstimateNode **children;
+} EstimateNode;
+
+void estimate_tree(const char *path, const Options *options, size_t probes);
+
+#endif
@@ -1,60 +1,289 @@
 #include "dirwalkFunc.h"
+#include "dirwalkReader.h"
+#include "dirwalkOutput.h"
+#include "dirwalkPredicate.h"
+#include "dirwalkDu.h"
+#include "dirwalkDupes.h"
+#include "dirwalkInodeSet.h"
+#include "dirwalkUring.h"
+#include "dirwalkWatch.h"
 
-void walk_directory(const char *path, const Options *options, int filter) {
-    struct dirent **namelist;
-    int n = scandir(path, &namelist, NULL, options->sort_output ? alphasort : NULL);
+size_t dir_prefix(char *buf, size_t size, const char *dir) {
+    size_t len = strlen(dir);
+    if (len + 2 > size)
+        return 0;
+    memcpy(buf, dir, len);
+    if (len == 0 || dir[len - 1] != '/')
+        buf[len++] = '/';
+    buf[len] = '\0';
+    return len;
+}
+
+int append_name(char *buf, size_t size, size_t prefix_len, const char *name) {
+    size_t len = strlen(name);
+    if (prefix_len + len + 1 > size) {
+        fprintf(stderr, "dirwalk: path too long: %.*s%s\n", (int)prefix_len, buf, name);
+        return -1;
+    }
+    memcpy(buf + prefix_len, name, len + 1);
+    return 0;
+}
+
+int dir_open_flags(const Options *options) {
+    return O_RDONLY | O_DIRECTORY | O_CLOEXEC | (options->follow_links ? 0 : O_NOFOLLOW);
+}
+
+static unsigned char mode_type(mode_t mode) {
+    if (S_ISLNK(mode))
+        return DT_LNK;
+    if (S_ISDIR(mode))
+        return DT_DIR;
+    if (S_ISREG(mode))
+        return DT_REG;
+#ifdef DT_FIFO
+    return DT_FIFO;
+#else
+    return DT_OTHER;
+#endif
+}
+
+/* d_type is trusted whenever the filesystem fills it in; only DT_UNKNOWN
+ * costs a stat, done relative to the already open directory. When links
+ * are followed, a link takes the type of its target; a dangling one stays
+ * DT_LNK. */
+unsigned char entry_type(int dirfd, const char *name, unsigned char d_type, int follow) {
+    struct stat st;
+    if (follow && (d_type == DT_LNK || d_type == DT_UNKNOWN) && fstatat(dirfd, name, &st, 0) == 0)
+        return mode_type(st.st_mode);
+    if (d_type != DT_UNKNOWN)
+        return d_type;
+
+    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+        perror("fstatat");
+        return DT_UNKNOWN;
+    }
+    return mode_type(st.st_mode);
+}
+
+/* Takes a stat fetched ahead of time (io_uring) as if entry_type() and
+ * entry_stat() had produced it. */
+void entry_prefetched(EntryInfo *entry, unsigned char d_type, const struct stat *st) {
+    entry->st = *st;
+    entry->have_stat = 1;
+    if (d_type == DT_UNKNOWN || (entry->follow && d_type == DT_LNK))
+        d_type = mode_type(st->st_mode);
+    entry->type = d_type;
+}
+
+int entry_stat(EntryInfo *entry) {
+    if (entry->have_stat)
+        return 0;
+    int flags = entry->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+    if (fstatat(entry->dirfd, entry->name, &entry->st, flags) < 0 &&
+        (!entry->follow || fstatat(entry->dirfd, entry->name, &entry->st, AT_SYMLINK_NOFOLLOW) < 0)) {
+        perror("fstatat");
+        return -1;
+    }
+    entry->have_stat = 1;
+    return 0;
+}
+
+int entry_matches(const Options *options, int filter, EntryInfo *entry) {
+    if (options->pred)
+        return pred_match(options->pred, entry);
+    if (!filter)
+        return 1;
+    return (options->show_links && entry->type == DT_LNK) ||
+           (options->show_dirs && entry->type == DT_DIR) ||
+           (options->show_files && entry->type == DT_REG);
+}
+
+/* With -L the same directory can be reached through several links, or
+ * through a link back to one of its ancestors: it is entered only the
+ * first time its (dev, ino) is seen. */
+int entry_descend(const Options *options, EntryInfo *entry) {
+    if (entry->type != DT_DIR)
+        return 0;
+    if (options->pred && !pred_descend(options->pred, entry))
+        return 0;
+    if (options->visited) {
+        if (entry_stat(entry) < 0)
+            return 0;
+        return inode_set_insert(options->visited, entry->st.st_dev, entry->st.st_ino);
+    }
+    return 1;
+}
+
+/* What happens to an entry that passed the filters depends on the mode:
+ * it goes to the caller's visitor, is printed, summed into the subtree
+ * totals, or kept as a dupe candidate. */
+int entry_visit(const Options *options, int filter, EntryInfo *entry, OutputBuffer *out,
+                const char *path, size_t path_len, DuTotals *totals) {
+    if (!entry_matches(options, filter, entry))
+        return WALK_CONTINUE;
+    if (options->visit)
+        return options->visit(entry, path, path_len, options->visit_arg);
+    if (options->du)
+        du_account(options->du, entry, totals);
+    else if (options->dupes)
+        dupes_add(options->dupes, entry, path, path_len);
+    else
+        output_path(out, path, path_len);
+    return WALK_CONTINUE;
+}
 
-    if (n < 0) {
-        perror("scandir");
+static const char *base_name(const char *path, char *buf, size_t size) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/')
+        len--;
+    size_t start = len;
+    while (start > 0 && path[start - 1] != '/')
+        start--;
+    if (len - start + 1 > size)
+        return path;
+    memcpy(buf, path + start, len - start);
+    buf[len - start] = '\0';
+    return buf;
+}
+
+void root_entry(const Options *options, EntryInfo *entry, const char *path, char *base, size_t size) {
+    memset(entry, 0, sizeof(*entry));
+    entry->dirfd = AT_FDCWD;
+    entry->follow = options->follow_links;
+    entry->name = path;
+    entry->base = base_name(path, base, size);
+    entry->type = DT_DIR;
+}
+
+typedef struct {
+    const Options *options;
+    int filter;
+    OutputBuffer *out;
+    char *path;
+    uint32_t watch_node;
+    int stop;
+} WalkContext;
+
+static void walk_fd(WalkContext *ctx, int fd, size_t len, int depth, DuTotals *totals) {
+    const Options *options = ctx->options;
+    char *path = ctx->path;
+    DirList list = {0};
+    if (dir_list_load(fd, &list, options) < 0) {
+        perror("getdents");
+        dir_list_free(&list);
+        close(fd);
         return;
     }
+    if (options->sort_output)
+        dir_list_sort(&list);
+    StatBatch batch = {0};
+    if (options->uring)
+        stat_batch_collect(&batch, fd, &list, options);
+
+    DirCursor cursor = {0};
+    const DirEntry *entry;
+    for (size_t idx = 0; (entry = dir_list_next(&list, &cursor)) != NULL; idx++) {
+        if (append_name(path, PATH_MAX, len, entry->name) < 0)
+            continue;
 
-    for (int i = 0; i < n; i++) {
-        struct dirent *entry = namelist[i];
+        EntryInfo info = {
+            .dirfd = fd,
+            .name = entry->name,
+            .base = entry->name,
+            .depth = depth,
+            .follow = options->follow_links,
+        };
+        if (idx < batch.count && batch.ok[idx])
+            entry_prefetched(&info, entry->type, &batch.st[idx]);
+        else
+            info.type = entry_type(fd, entry->name, entry->type, options->follow_links);
+        if (info.type == DT_UNKNOWN)
+            continue;
 
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            free(entry);
+        size_t child_len = len + strlen(entry->name);
+        if (!entry_descend(options, &info)) {
+            if (entry_visit(options, ctx->filter, &info, ctx->out, path, child_len, totals) == WALK_STOP) {
+                ctx->stop = 1;
+                break;
+            }
             continue;
         }
 
-        char full_path[PATH_MAX];
-        size_t len = strlen(path);
-        if (strcmp(path, ".") == 0) {
-            snprintf(full_path, sizeof(full_path), "./%s", entry->d_name);
-        } else {
-            if (len > 0 && path[len - 1] == '/')
-                snprintf(full_path, sizeof(full_path), "%s%s", path, entry->d_name);
-            else
-                snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+        DuTotals sub = {0};
+        int action = entry_visit(options, ctx->filter, &info, ctx->out, path, child_len, &sub);
+        if (action == WALK_STOP) {
+            ctx->stop = 1;
+            break;
         }
-
-        struct stat st;
-        if (lstat(full_path, &st) < 0) {
-            perror("lstat");
-            free(entry);
+        if (action == WALK_SKIP)
             continue;
+
+        int child = openat(fd, entry->name, dir_open_flags(options));
+        if (child < 0) {
+            perror("openat");
+        } else if (child_len + 1 >= PATH_MAX) {
+            close(child);
+        } else {
+            uint32_t parent_node = ctx->watch_node;
+            if (options->watch)
+                ctx->watch_node = watch_add(options->watch, parent_node, entry->name, path);
+            path[child_len] = '/';
+            path[child_len + 1] = '\0';
+            walk_fd(ctx, child, child_len + 1, depth + 1, &sub);
+            path[child_len] = '\0';
+            ctx->watch_node = parent_node;
         }
 
-        int is_symlink = S_ISLNK(st.st_mode);
-        int is_dir     = S_ISDIR(st.st_mode);
-        int is_file    = S_ISREG(st.st_mode);
-
-        if (filter ?
-            ((options->show_links && is_symlink) ||
-            (options->show_dirs && is_dir) ||
-            (options->show_files && is_file))
-            : 1)
-        {
-            printf("%s\n", full_path);
+        if (options->du) {
+            du_report(options->du, path, &sub);
+            du_add(totals, &sub);
         }
+        if (ctx->stop)
+            break;
+    }
+
+    stat_batch_free(&batch);
+    dir_list_free(&list);
+    close(fd);
+}
+
+void walk_directory(const char *path, const Options *options, int filter) {
+    char buf[PATH_MAX];
+    size_t len = dir_prefix(buf, sizeof(buf), path);
+    if (len == 0) {
+        fprintf(stderr, "dirwalk: path too long: %s\n", path);
+        return;
+    }
+
+    OutputBuffer out;
+    output_init(&out, STDOUT_FILENO, options->separator, NULL);
+
+    WalkContext ctx = { .options = options, .filter = filter, .out = &out, .path = buf };
+    DuTotals totals = {0};
 
-        if (is_dir && !is_symlink &&
-            strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
-        {
-            walk_directory(full_path, options, filter);
+    EntryInfo root;
+    char base[NAME_MAX + 1];
+    root_entry(options, &root, path, base, sizeof(base));
+    int action = entry_visit(options, filter, &root, &out, path, strlen(path), &totals);
+
+    if (action == WALK_CONTINUE && entry_descend(options, &root)) {
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            perror("open");
+        } else {
+            if (options->watch)
+                ctx.watch_node = watch_root(options->watch, path);
+            walk_fd(&ctx, fd, len, 1, &totals);
+            dir_list_release_spares();
+            stat_batch_release();
         }
+    }
 
-        free(entry);
+    if (options->du) {
+        du_report(options->du, path, &totals);
+        du_print(options->du, &out);
     }
-    free(namelist);
+    if (options->dupes)
+        dupes_print(options->dupes, &out);
+    output_free(&out);
 }
@@ -2,23 +2,87 @@
 #define DIRWALK_H
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <unistd.h>
 #include <locale.h>
 #include <limits.h>
 
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN 0
+#define DT_DIR     4
+#define DT_REG     8
+#define DT_LNK     10
+#define DT_OTHER   1
+#endif
+
+struct DirCache;
+struct Predicate;
+struct DuState;
+struct DupesState;
+struct InodeSet;
+struct WatchState;
+struct OutputBuffer;
+struct DuTotals;
+struct EntryInfo;
+
+/* What a visitor returns for an entry. WALK_SKIP on a directory keeps the
+ * walker out of it; WALK_STOP ends the walk. */
+#define WALK_CONTINUE 0
+#define WALK_SKIP     1
+#define WALK_STOP     2
+
+typedef int (*WalkVisitor)(struct EntryInfo *entry, const char *path, size_t path_len, void *arg);
+
 typedef struct {
     int show_links;
     int show_dirs;
     int show_files;
     int sort_output;
+    int follow_links;
+    int uring;
+    int jobs;
+    int max_fds;
+    char separator;
+    struct DirCache *cache;
+    struct Predicate *pred;
+    struct DuState *du;
+    struct DupesState *dupes;
+    struct InodeSet *visited;
+    struct WatchState *watch;
+    WalkVisitor visit;
+    void *visit_arg;
 } Options;
 
+/* What the walkers know about one entry; the stat is filled lazily. With
+ * `follow` set, type and stat describe the target of a symlink. */
+typedef struct EntryInfo {
+    int dirfd;
+    const char *name;
+    const char *base;
+    unsigned char type;
+    int depth;
+    int follow;
+    int have_stat;
+    struct stat st;
+} EntryInfo;
+
 void walk_directory(const char *path, const Options *options, int filter);
+size_t dir_prefix(char *buf, size_t size, const char *dir);
+int append_name(char *buf, size_t size, size_t prefix_len, const char *name);
+int dir_open_flags(const Options *options);
+unsigned char entry_type(int dirfd, const char *name, unsigned char d_type, int follow);
+void entry_prefetched(EntryInfo *entry, unsigned char d_type, const struct stat *st);
+int entry_stat(EntryInfo *entry);
+int entry_matches(const Options *options, int filter, EntryInfo *entry);
+int entry_descend(const Options *options, EntryInfo *entry);
+int  entry_visit(const Options *options, int filter, EntryInfo *entry, struct OutputBuffer *out,
+                 const char *path, size_t path_len, struct DuTotals *totals);
+void root_entry(const Options *options, EntryInfo *entry, const char *path, char *base, size_t size);
 
 #endif
-
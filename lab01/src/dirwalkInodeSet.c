@@ -0,0 +1,144 @@
+#include "dirwalkInodeSet.h"
+
+#define SHARD_INITIAL_CAPACITY 256
+
+static uint64_t inode_hash(uint64_t dev, uint64_t ino) {
+    uint64_t x = ino ^ (dev * 0x9e3779b97f4a7c15ULL);
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+void inode_set_init(InodeSet *set) {
+    memset(set, 0, sizeof(*set));
+    for (int i = 0; i < INODE_SET_SHARDS; i++)
+        pthread_mutex_init(&set->shards[i].lock, NULL);
+}
+
+/* `slots` must be a power of two. */
+void inode_set_init_lockfree(InodeSet *set, size_t slots) {
+    inode_set_init(set);
+    set->fast = calloc(slots, sizeof(*set->fast));
+    if (!set->fast) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    set->fast_mask = slots - 1;
+}
+
+static int fast_dev_index(InodeSet *set, uint64_t dev) {
+    for (int i = 0; i < INODE_FAST_DEVS; i++) {
+        uint64_t cur = atomic_load(&set->devs[i]);
+        if (cur == 0) {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong(&set->devs[i], &expected, dev + 1))
+                return i;
+            cur = expected;
+        }
+        if (cur == dev + 1)
+            return i;
+    }
+    return -1;
+}
+
+/* Insert-only linear probing: a slot goes from empty to a key exactly once,
+ * so a CAS is enough. If the whole probe run holds other keys, this key can
+ * never appear in it, which is what makes the overflow to the shards exact.
+ * Returns 1 if inserted, 0 if present, -1 if the shards must decide. */
+static int fast_insert(InodeSet *set, uint64_t dev, uint64_t ino, uint64_t hash) {
+    if (ino >> 56 != 0 || dev == UINT64_MAX)
+        return -1;
+    int idx = fast_dev_index(set, dev);
+    if (idx < 0)
+        return -1;
+
+    uint64_t key = ((uint64_t)(idx + 1) << 56) | ino;
+    size_t i = (hash / INODE_SET_SHARDS) & set->fast_mask;
+    for (int probe = 0; probe < INODE_FAST_PROBES; probe++) {
+        uint64_t cur = atomic_load_explicit(&set->fast[i], memory_order_relaxed);
+        if (cur == 0) {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong_explicit(&set->fast[i], &expected, key,
+                                                        memory_order_relaxed, memory_order_relaxed))
+                return 1;
+            cur = expected;
+        }
+        if (cur == key)
+            return 0;
+        i = (i + 1) & set->fast_mask;
+    }
+    return -1;
+}
+
+static void shard_insert_slot(InodeKey *slots, size_t cap, InodeKey key, uint64_t hash) {
+    size_t i = (hash / INODE_SET_SHARDS) & (cap - 1);
+    while (slots[i].dev != 0 || slots[i].ino != 0)
+        i = (i + 1) & (cap - 1);
+    slots[i] = key;
+}
+
+static void shard_grow(InodeShard *shard) {
+    size_t cap = shard->cap ? shard->cap * 2 : SHARD_INITIAL_CAPACITY;
+    InodeKey *slots = calloc(cap, sizeof(InodeKey));
+    if (!slots) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < shard->cap; i++) {
+        InodeKey key = shard->slots[i];
+        if (key.dev != 0 || key.ino != 0)
+            shard_insert_slot(slots, cap, key, inode_hash(key.dev, key.ino));
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->cap = cap;
+}
+
+/* Returns 1 if (dev, ino) was not in the set yet. {0, 0} marks an empty slot
+ * and is tracked by a flag instead. */
+int inode_set_insert(InodeSet *set, dev_t dev, ino_t ino) {
+    InodeKey key = { (uint64_t)dev, (uint64_t)ino };
+    uint64_t hash = inode_hash(key.dev, key.ino);
+    if (set->fast) {
+        int fast = fast_insert(set, key.dev, key.ino, hash);
+        if (fast >= 0)
+            return fast;
+    }
+    InodeShard *shard = &set->shards[hash % INODE_SET_SHARDS];
+    int inserted = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    if (key.dev == 0 && key.ino == 0) {
+        inserted = !shard->has_zero;
+        shard->has_zero = 1;
+    } else {
+        if ((shard->count + 1) * 4 > shard->cap * 3)
+            shard_grow(shard);
+        size_t i = (hash / INODE_SET_SHARDS) & (shard->cap - 1);
+        for (;;) {
+            InodeKey *slot = &shard->slots[i];
+            if (slot->dev == 0 && slot->ino == 0) {
+                *slot = key;
+                shard->count++;
+                inserted = 1;
+                break;
+            }
+            if (slot->dev == key.dev && slot->ino == key.ino)
+                break;
+            i = (i + 1) & (shard->cap - 1);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return inserted;
+}
+
+void inode_set_destroy(InodeSet *set) {
+    for (int i = 0; i < INODE_SET_SHARDS; i++) {
+        pthread_mutex_destroy(&set->shards[i].lock);
+        free(set->shards[i].slots);
+    }
+    free(set->fast);
+}
@@ -0,0 +1,46 @@
+#ifndef DIRWALK_INODE_SET_H
+#define DIRWALK_INODE_SET_H
+
+#include "dirwalkFunc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define INODE_SET_SHARDS   64
+#define INODE_FAST_SLOTS   (1u << 16)
+#define INODE_FAST_PROBES  32
+#define INODE_FAST_DEVS    255
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+} InodeKey;
+
+typedef struct {
+    pthread_mutex_t lock;
+    InodeKey *slots;
+    size_t count;
+    size_t cap;
+    int has_zero;
+} InodeShard;
+
+/* (dev, ino) set shared by all walker threads. The hash picks a shard and
+ * only that shard is locked, so threads rarely wait on each other.
+ *
+ * Optionally the set is fronted by a fixed lock-free table of 8-byte keys:
+ * the device is replaced by its index in `devs` (top byte), the inode
+ * fills the rest. Keys that do not fit, or whose probe run is full, go to
+ * the shards. */
+typedef struct InodeSet {
+    InodeShard shards[INODE_SET_SHARDS];
+    atomic_uint_least64_t *fast;
+    size_t fast_mask;
+    atomic_uint_least64_t devs[INODE_FAST_DEVS];
+} InodeSet;
+
+void inode_set_init(InodeSet *set);
+void inode_set_init_lockfree(InodeSet *set, size_t slots);
+int  inode_set_insert(InodeSet *set, dev_t dev, ino_t ino);
+void inode_set_destroy(InodeSet *set);
+
+#endif
@@ -0,0 +1,53 @@
+#include "dirwalkLib.h"
+#include "dirwalkBounded.h"
+#include "dirwalkParallel.h"
+#include "dirwalkWatch.h"
+#include <stdatomic.h>
+
+typedef struct {
+    WalkVisitor visit;
+    void *arg;
+    atomic_int stopped;
+} VisitState;
+
+void dirwalk_options_init(Options *options) {
+    memset(options, 0, sizeof(*options));
+    options->jobs = 1;
+    options->separator = '\n';
+}
+
+/* Picks the walker for the options; --watch keeps following the tree after
+ * the initial walk. */
+void dirwalk_run(const char *path, const Options *options, int filter) {
+    if (options->max_fds)
+        walk_directory_bounded(path, options, filter);
+    else if (options->jobs > 1)
+        walk_directory_parallel(path, options, filter);
+    else
+        walk_directory(path, options, filter);
+    if (options->watch)
+        watch_run(options->watch);
+}
+
+static int visit_recorded(EntryInfo *entry, const char *path, size_t path_len, void *arg) {
+    VisitState *state = arg;
+    int action = state->visit(entry, path, path_len, state->arg);
+    if (action == WALK_STOP)
+        atomic_store(&state->stopped, 1);
+    return action;
+}
+
+/* Walks `path` calling `visit` instead of printing. Returns 1 if the
+ * visitor stopped the walk, 0 if it ran to the end. */
+int dirwalk_visit(const char *path, const Options *options, WalkVisitor visit, void *arg) {
+    VisitState state = { .visit = visit, .arg = arg };
+    Options copy = *options;
+    copy.visit = visit_recorded;
+    copy.visit_arg = &state;
+    copy.du = NULL;
+    copy.dupes = NULL;
+    copy.watch = NULL;
+    int filter = copy.show_links || copy.show_dirs || copy.show_files;
+    dirwalk_run(path, &copy, filter);
+    return atomic_load(&state.stopped);
+}
@@ -0,0 +1,18 @@
+#ifndef DIRWALK_LIB_H
+#define DIRWALK_LIB_H
+
+#include "dirwalkFunc.h"
+
+/* Entry point of libdirwalk.a. A visitor gets every entry that passes the
+ * filters in `options`: entry->dirfd and entry->name address it relative
+ * to its open parent, entry_stat(entry) fills and caches entry->st (with
+ * the uring backend it is usually already there), and `path` is the full
+ * path, valid only during the call. With jobs > 1 the visitor runs on
+ * several threads at once; with sort_output the order is the one dirwalk
+ * -s prints in (per thread when parallel). */
+
+void dirwalk_options_init(Options *options);
+void dirwalk_run(const char *path, const Options *options, int filter);
+int  dirwalk_visit(const char *path, const Options *options, WalkVisitor visit, void *arg);
+
+#endif
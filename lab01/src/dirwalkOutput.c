@@ -0,0 +1,118 @@
+#include "dirwalkOutput.h"
+#include <errno.h>
+#include <sys/uio.h>
+
+static void write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/* Sends whatever is buffered plus an optional tail in one writev, so a record
+ * larger than the buffer never has to be copied. The lock is held only for
+ * the syscall itself: filling the buffers never contends. */
+static void output_write(OutputBuffer *out, const char *tail, size_t tail_len, int with_separator) {
+    struct iovec iov[3];
+    int count = 0;
+    if (out->len > 0)
+        iov[count++] = (struct iovec){ .iov_base = out->data, .iov_len = out->len };
+    if (tail_len > 0)
+        iov[count++] = (struct iovec){ .iov_base = (void *)tail, .iov_len = tail_len };
+    if (with_separator)
+        iov[count++] = (struct iovec){ .iov_base = &out->separator, .iov_len = 1 };
+    if (count == 0)
+        return;
+
+    if (out->lock)
+        pthread_mutex_lock(out->lock);
+    write_all(out->fd, iov, count);
+    if (out->lock)
+        pthread_mutex_unlock(out->lock);
+    out->len = 0;
+}
+
+static void output_grow(OutputBuffer *out, size_t need) {
+    size_t cap = out->cap ? out->cap : 256;
+    while (cap < out->len + need)
+        cap *= 2;
+    char *data = realloc(out->data, cap);
+    if (!data) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    out->data = data;
+    out->cap = cap;
+}
+
+void output_init(OutputBuffer *out, int fd, char separator, pthread_mutex_t *lock) {
+    out->fd = fd;
+    out->separator = separator;
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+    out->lock = lock;
+    if (fd >= 0)
+        output_grow(out, OUTPUT_BUFFER_SIZE);
+}
+
+void output_bytes(OutputBuffer *out, const char *data, size_t len) {
+    if (len == 0)
+        return;
+    if (out->len + len > out->cap) {
+        if (out->fd < 0) {
+            output_grow(out, len);
+        } else if (len >= out->cap) {
+            output_write(out, data, len, 0);
+            return;
+        } else {
+            output_write(out, NULL, 0, 0);
+        }
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+void output_path(OutputBuffer *out, const char *path, size_t len) {
+    if (out->len + len + 1 > out->cap) {
+        if (out->fd < 0) {
+            output_grow(out, len + 1);
+        } else {
+            output_write(out, NULL, 0, 0);
+            if (len + 1 > out->cap) {
+                output_write(out, path, len, 1);
+                return;
+            }
+        }
+    }
+    memcpy(out->data + out->len, path, len);
+    out->len += len;
+    out->data[out->len++] = out->separator;
+}
+
+void output_flush(OutputBuffer *out) {
+    if (out->fd >= 0)
+        output_write(out, NULL, 0, 0);
+}
+
+void output_free(OutputBuffer *out) {
+    output_flush(out);
+    free(out->data);
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
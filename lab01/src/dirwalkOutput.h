@@ -0,0 +1,27 @@
+#ifndef DIRWALK_OUTPUT_H
+#define DIRWALK_OUTPUT_H
+
+#include "dirwalkFunc.h"
+#include <pthread.h>
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/* fd < 0 turns the buffer into an in-memory accumulator that only grows;
+ * otherwise it is flushed to fd with write/writev, under `lock` if several
+ * buffers share the same descriptor. */
+typedef struct OutputBuffer {
+    int fd;
+    char separator;
+    char *data;
+    size_t len;
+    size_t cap;
+    pthread_mutex_t *lock;
+} OutputBuffer;
+
+void output_init(OutputBuffer *out, int fd, char separator, pthread_mutex_t *lock);
+void output_bytes(OutputBuffer *out, const char *data, size_t len);
+void output_path(OutputBuffer *out, const char *path, size_t len);
+void output_flush(OutputBuffer *out);
+void output_free(OutputBuffer *out);
+
+#endif
@@ -0,0 +1,437 @@
+#include "dirwalkParallel.h"
+#include "dirwalkReader.h"
+#include "dirwalkOutput.h"
+#include "dirwalkPredicate.h"
+#include "dirwalkDu.h"
+#include "dirwalkDupes.h"
+#include "dirwalkUring.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct DirNode {
+    char *path;
+    int depth;
+    struct DirNode *parent;
+    atomic_int pending;
+    DuTotals totals;
+    OutputBuffer out;
+    struct DirNode **children;
+    size_t *child_offsets;
+    size_t child_count;
+    size_t child_cap;
+    int ready;
+    size_t emitted;
+    size_t next_child;
+} DirNode;
+
+typedef struct {
+    pthread_mutex_t lock;
+    DirNode **items;
+    size_t head;
+    size_t count;
+    size_t cap;
+} WorkDeque;
+
+typedef struct Pool Pool;
+
+typedef struct {
+    Pool *pool;
+    int id;
+    OutputBuffer out;
+} Worker;
+
+struct Pool {
+    const Options *options;
+    int filter;
+    int workers;
+    WorkDeque *deques;
+    atomic_size_t pending;
+    atomic_size_t queued;
+    atomic_int sleeping;
+    atomic_int stop;
+    int done;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    pthread_mutex_t out_lock;
+    pthread_mutex_t emit_lock;
+    DirNode *cursor;
+    OutputBuffer ordered;
+};
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+static DirNode *node_new(const char *path, int depth, char separator) {
+    DirNode *node = calloc(1, sizeof(DirNode));
+    if (!node || !(node->path = strdup(path))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    node->depth = depth;
+    atomic_init(&node->pending, 1);
+    output_init(&node->out, -1, separator, NULL);
+    return node;
+}
+
+static void node_free(DirNode *node) {
+    free(node->path);
+    output_free(&node->out);
+    free(node->children);
+    free(node->child_offsets);
+    free(node);
+}
+
+/* Ordered replay is only needed when -s output goes straight to stdout;
+ * --du and --dupes print their own summaries after the walk. */
+static int ordered_output(const Options *options) {
+    return options->sort_output && !options->du && !options->dupes;
+}
+
+static void node_add_child(DirNode *node, DirNode *child) {
+    if (node->child_count == node->child_cap) {
+        node->child_cap = node->child_cap ? node->child_cap * 2 : 8;
+        node->children = xrealloc(node->children, node->child_cap * sizeof(DirNode *));
+        node->child_offsets = xrealloc(node->child_offsets, node->child_cap * sizeof(size_t));
+    }
+    node->children[node->child_count] = child;
+    node->child_offsets[node->child_count] = node->out.len;
+    node->child_count++;
+}
+
+/* Owner pushes and pops at the tail (LIFO, keeps the subtree hot),
+ * thieves take from the head, i.e. the oldest and usually largest subtrees. */
+static void deque_push(WorkDeque *dq, DirNode *node) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        size_t cap = dq->cap ? dq->cap * 2 : DEQUE_INITIAL_CAPACITY;
+        DirNode **items = malloc(cap * sizeof(DirNode *));
+        if (!items) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < dq->count; i++)
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+    dq->items[(dq->head + dq->count) % dq->cap] = node;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static DirNode *deque_pop(WorkDeque *dq) {
+    DirNode *node = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        node = dq->items[(dq->head + dq->count) % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return node;
+}
+
+static DirNode *deque_steal(WorkDeque *dq) {
+    DirNode *node = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        node = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return node;
+}
+
+static void pool_submit(Pool *pool, int worker, DirNode *node) {
+    atomic_fetch_add(&pool->pending, 1);
+    deque_push(&pool->deques[worker], node);
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+static DirNode *pool_take(Pool *pool, int worker) {
+    DirNode *node = deque_pop(&pool->deques[worker]);
+    for (int i = 1; !node && i < pool->workers; i++)
+        node = deque_steal(&pool->deques[(worker + i) % pool->workers]);
+    if (node)
+        atomic_fetch_sub(&pool->queued, 1);
+    return node;
+}
+
+/* Bottom-up reduction for --du: a node is finished once it and all of its
+ * children are, then its totals are reported and folded into the parent.
+ * The root has no parent and stays alive for the caller. */
+static void node_finish(Pool *pool, DirNode *node) {
+    DuState *du = pool->options->du;
+    while (node && atomic_fetch_sub(&node->pending, 1) == 1) {
+        DirNode *parent = node->parent;
+        du_report(du, node->path, &node->totals);
+        if (parent)
+            du_add(&parent->totals, &node->totals);
+        if (parent)
+            node_free(node);
+        node = parent;
+    }
+}
+
+static void process_directory(Pool *pool, Worker *worker, DirNode *node) {
+    const Options *options = pool->options;
+    if (atomic_load_explicit(&pool->stop, memory_order_relaxed))
+        return;
+    OutputBuffer *out = ordered_output(options) ? &node->out : &worker->out;
+    int fd = open(node->path, node->depth > 1 ? dir_open_flags(options) : O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open");
+        return;
+    }
+    DirList list = {0};
+    if (dir_list_load(fd, &list, options) < 0) {
+        perror("getdents");
+        dir_list_free(&list);
+        close(fd);
+        return;
+    }
+    if (options->sort_output)
+        dir_list_sort(&list);
+
+    char full_path[PATH_MAX];
+    size_t len = dir_prefix(full_path, sizeof(full_path), node->path);
+    DuTotals totals = {0};
+    StatBatch batch = {0};
+    if (options->uring)
+        stat_batch_collect(&batch, fd, &list, options);
+
+    DirCursor cursor = {0};
+    const DirEntry *entry;
+    for (size_t idx = 0; (entry = dir_list_next(&list, &cursor)) != NULL; idx++) {
+        if (len == 0 || append_name(full_path, sizeof(full_path), len, entry->name) < 0)
+            continue;
+
+        EntryInfo info = {
+            .dirfd = fd,
+            .name = entry->name,
+            .base = entry->name,
+            .depth = node->depth,
+            .follow = options->follow_links,
+        };
+        if (idx < batch.count && batch.ok[idx])
+            entry_prefetched(&info, entry->type, &batch.st[idx]);
+        else
+            info.type = entry_type(fd, entry->name, entry->type, options->follow_links);
+        if (info.type == DT_UNKNOWN)
+            continue;
+
+        if (!entry_descend(options, &info)) {
+            if (entry_visit(options, pool->filter, &info, out, full_path, len + strlen(entry->name),
+                            &totals) == WALK_STOP) {
+                atomic_store(&pool->stop, 1);
+                break;
+            }
+            continue;
+        }
+
+        DirNode *child = node_new(full_path, node->depth + 1, options->separator);
+        int action = entry_visit(options, pool->filter, &info, out, full_path, len + strlen(entry->name),
+                                 &child->totals);
+        if (action != WALK_CONTINUE) {
+            node_free(child);
+            if (action == WALK_STOP) {
+                atomic_store(&pool->stop, 1);
+                break;
+            }
+            continue;
+        }
+        child->parent = node;
+        atomic_fetch_add(&node->pending, 1);
+        if (ordered_output(options))
+            node_add_child(node, child);
+        pool_submit(pool, worker->id, child);
+    }
+    du_add(&node->totals, &totals);
+
+    stat_batch_free(&batch);
+    dir_list_free(&list);
+    close(fd);
+}
+
+/* Streams -s output in the serial walker's pre-order while the pool is
+ * still running. The cursor is the first node whose output has not been
+ * written yet: its text is written up to the next child, then the walk goes
+ * into that child, and once the child and its whole subtree are written it is
+ * freed and the walk returns to the parent. It stops at a node that is not
+ * processed yet; whoever finishes that node picks the walk up again. */
+static void emit_ready(Pool *pool, DirNode *done) {
+    pthread_mutex_lock(&pool->emit_lock);
+    done->ready = 1;
+    DirNode *node = pool->cursor;
+    while (node && node->ready) {
+        size_t end = node->next_child < node->child_count ? node->child_offsets[node->next_child]
+                                                           : node->out.len;
+        output_bytes(&pool->ordered, node->out.data + node->emitted, end - node->emitted);
+        node->emitted = end;
+        if (node->next_child < node->child_count) {
+            node = node->children[node->next_child++];
+            continue;
+        }
+        DirNode *parent = node->parent;
+        node_free(node);
+        node = parent;
+    }
+    pool->cursor = node;
+    pthread_mutex_unlock(&pool->emit_lock);
+}
+
+static void *worker_main(void *arg) {
+    Worker *self = arg;
+    Pool *pool = self->pool;
+
+    for (;;) {
+        DirNode *node = pool_take(pool, self->id);
+        if (!node) {
+            pthread_mutex_lock(&pool->idle_lock);
+            atomic_fetch_add(&pool->sleeping, 1);
+            while (!pool->done && atomic_load(&pool->queued) == 0)
+                pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+            atomic_fetch_sub(&pool->sleeping, 1);
+            int done = pool->done;
+            pthread_mutex_unlock(&pool->idle_lock);
+            if (done)
+                break;
+            continue;
+        }
+
+        process_directory(pool, self, node);
+
+        /* Ordered output hands the node to the emitter. Unsorted output has
+         * no ordering guarantee: entries already went to the worker's own
+         * buffer, so the node can be dropped right away. */
+        if (pool->options->du)
+            node_finish(pool, node);
+        else if (ordered_output(pool->options))
+            emit_ready(pool, node);
+        else if (node->parent)
+            node_free(node);
+
+        if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+            pthread_mutex_lock(&pool->idle_lock);
+            pool->done = 1;
+            pthread_cond_broadcast(&pool->idle_cond);
+            pthread_mutex_unlock(&pool->idle_lock);
+        }
+    }
+    output_free(&self->out);
+    dir_list_release_spares();
+    stat_batch_release();
+    return NULL;
+}
+
+void walk_directory_parallel(const char *path, const Options *options, int filter) {
+    Pool pool = {
+        .options = options,
+        .filter = filter,
+        .workers = options->jobs,
+    };
+    pool.deques = calloc(pool.workers, sizeof(WorkDeque));
+    Worker *workers = calloc(pool.workers, sizeof(Worker));
+    pthread_t *threads = calloc(pool.workers, sizeof(pthread_t));
+    if (!pool.deques || !workers || !threads) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&pool.idle_lock, NULL);
+    pthread_cond_init(&pool.idle_cond, NULL);
+    pthread_mutex_init(&pool.out_lock, NULL);
+    pthread_mutex_init(&pool.emit_lock, NULL);
+    output_init(&pool.ordered, STDOUT_FILENO, options->separator, &pool.out_lock);
+    for (int i = 0; i < pool.workers; i++)
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+    /* Workers start idle and only see work once the root is submitted, so
+     * the root line is guaranteed to be the first thing written. */
+    int started = 0;
+    for (int i = 0; i < pool.workers; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        output_init(&workers[i].out, STDOUT_FILENO, options->separator, &pool.out_lock);
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            output_free(&workers[i].out);
+            break;
+        }
+        started++;
+    }
+
+    if (started == 0) {
+        fprintf(stderr, "dirwalk: no worker threads, falling back to serial walk\n");
+        walk_directory(path, options, filter);
+    } else {
+        OutputBuffer out;
+        output_init(&out, STDOUT_FILENO, options->separator, &pool.out_lock);
+
+        EntryInfo info;
+        char base[NAME_MAX + 1];
+        root_entry(options, &info, path, base, sizeof(base));
+        DirNode *root = node_new(path, 1, options->separator);
+        int action = entry_visit(options, filter, &info, &out, path, strlen(path), &root->totals);
+        output_flush(&out);
+        int submitted = action == WALK_CONTINUE && entry_descend(options, &info);
+        if (submitted) {
+            /* Nodes are only touched by their worker until they are ready,
+             * so the cursor can be set before anyone else sees the root. */
+            if (ordered_output(options))
+                pool.cursor = root;
+            pool_submit(&pool, 0, root);
+        } else {
+            pthread_mutex_lock(&pool.idle_lock);
+            pool.done = 1;
+            pthread_cond_broadcast(&pool.idle_cond);
+            pthread_mutex_unlock(&pool.idle_lock);
+        }
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+
+        if (options->du) {
+            if (atomic_load(&root->pending) > 0)
+                du_report(options->du, path, &root->totals);
+            du_print(options->du, &out);
+            node_free(root);
+        } else if (options->dupes) {
+            dupes_print(options->dupes, &out);
+            node_free(root);
+        } else if (ordered_output(options) && submitted) {
+            /* The emitter freed every node, the root last. */
+            output_flush(&pool.ordered);
+        } else {
+            node_free(root);
+        }
+        output_free(&out);
+    }
+
+    for (int i = 0; i < pool.workers; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].items);
+    }
+    pthread_mutex_destroy(&pool.idle_lock);
+    pthread_cond_destroy(&pool.idle_cond);
+    output_free(&pool.ordered);
+    pthread_mutex_destroy(&pool.emit_lock);
+    pthread_mutex_destroy(&pool.out_lock);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+}
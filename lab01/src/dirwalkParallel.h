@@ -0,0 +1,10 @@
+#ifndef DIRWALK_PARALLEL_H
+#define DIRWALK_PARALLEL_H
+
+#include "dirwalkFunc.h"
+
+#define MAX_JOBS 256
+
+void walk_directory_parallel(const char *path, const Options *options, int filter);
+
+#endif
@@ -0,0 +1,252 @@
+#include "dirwalkPredicate.h"
+#include <errno.h>
+#include <fnmatch.h>
+
+#define TYPE_LINK 1
+#define TYPE_DIR  2
+#define TYPE_FILE 4
+
+static void pred_emit(Predicate *pred, PredOp op, int64_t arg, const char *pattern) {
+    if (pred->len == pred->cap) {
+        size_t cap = pred->cap ? pred->cap * 2 : 8;
+        PredInsn *code = realloc(pred->code, cap * sizeof(PredInsn));
+        if (!code) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        pred->code = code;
+        pred->cap = cap;
+    }
+    pred->code[pred->len++] = (PredInsn){ .op = op, .arg = arg, .pattern = pattern };
+}
+
+Predicate *pred_new(void) {
+    Predicate *pred = calloc(1, sizeof(Predicate));
+    if (!pred) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pred->max_depth = -1;
+    return pred;
+}
+
+static int parse_number(const char *value, int64_t *out, int with_units) {
+    char *end;
+    errno = 0;
+    long long n = strtoll(value, &end, 10);
+    if (errno != 0 || end == value || n < 0)
+        return -1;
+    if (with_units && *end != '\0' && end[1] == '\0') {
+        switch (*end) {
+            case 'c': break;
+            case 'k': n *= 1024LL; break;
+            case 'M': n *= 1024LL * 1024; break;
+            case 'G': n *= 1024LL * 1024 * 1024; break;
+            default: return -1;
+        }
+        end++;
+    }
+    if (*end != '\0')
+        return -1;
+    *out = n;
+    return 0;
+}
+
+/* "+N" means more than N, "-N" less than N, "N" exactly N, as in find. */
+static int parse_compare(Predicate *pred, const char *value, PredOp gt, int with_units) {
+    PredOp op = gt + 2;
+    if (*value == '+') {
+        op = gt;
+        value++;
+    } else if (*value == '-') {
+        op = gt + 1;
+        value++;
+    }
+    int64_t n;
+    if (parse_number(value, &n, with_units) < 0)
+        return -1;
+    pred_emit(pred, op, n, NULL);
+    return 0;
+}
+
+static int parse_depth(const char *value, int *out) {
+    int64_t n;
+    if (parse_number(value, &n, 0) < 0 || n > INT_MAX)
+        return -1;
+    *out = (int)n;
+    return 0;
+}
+
+/* Returns 1 if the option takes the value, 0 if it is a flag, -1 on error
+ * and -2 if the option is not a predicate at all. */
+int pred_parse(Predicate *pred, const char *option, const char *value) {
+    if (strcmp(option, "--xdev") == 0) {
+        pred->xdev = 1;
+        return 0;
+    }
+
+    if (strcmp(option, "--name") != 0 && strcmp(option, "--prune") != 0 &&
+        strcmp(option, "--size") != 0 && strcmp(option, "--mmin") != 0 &&
+        strcmp(option, "--maxdepth") != 0 && strcmp(option, "--mindepth") != 0)
+        return -2;
+    if (!value)
+        return -1;
+
+    if (strcmp(option, "--name") == 0) {
+        pred_emit(pred, OP_NAME, 0, value);
+    } else if (strcmp(option, "--prune") == 0) {
+        if (pred->prune_count == pred->prune_cap) {
+            size_t cap = pred->prune_cap ? pred->prune_cap * 2 : 4;
+            const char **prune = realloc(pred->prune, cap * sizeof(char *));
+            if (!prune) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+            pred->prune = prune;
+            pred->prune_cap = cap;
+        }
+        pred->prune[pred->prune_count++] = value;
+    } else if (strcmp(option, "--size") == 0) {
+        if (parse_compare(pred, value, OP_SIZE_GT, 1) < 0)
+            return -1;
+    } else if (strcmp(option, "--mmin") == 0) {
+        if (parse_compare(pred, value, OP_MMIN_GT, 0) < 0)
+            return -1;
+    } else if (strcmp(option, "--maxdepth") == 0) {
+        if (parse_depth(value, &pred->max_depth) < 0)
+            return -1;
+    } else if (parse_depth(value, &pred->min_depth) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+static int op_cost(PredOp op) {
+    switch (op) {
+        case OP_MIN_DEPTH: return 0;
+        case OP_TYPE:      return 1;
+        case OP_NAME:
+        case OP_NOT_NAME:  return 2;
+        default:           return 3;
+    }
+}
+
+int pred_compile(Predicate *pred, const Options *options, int filter, const char *root) {
+    if (pred->min_depth > 0)
+        pred_emit(pred, OP_MIN_DEPTH, pred->min_depth, NULL);
+    if (filter) {
+        int mask = (options->show_links ? TYPE_LINK : 0) |
+                   (options->show_dirs ? TYPE_DIR : 0) |
+                   (options->show_files ? TYPE_FILE : 0);
+        pred_emit(pred, OP_TYPE, mask, NULL);
+    }
+    for (size_t i = 0; i < pred->prune_count; i++)
+        pred_emit(pred, OP_NOT_NAME, 0, pred->prune[i]);
+
+    /* Stable insertion sort: equal-cost tests keep command-line order. */
+    for (size_t i = 1; i < pred->len; i++) {
+        PredInsn insn = pred->code[i];
+        size_t j = i;
+        while (j > 0 && op_cost(pred->code[j - 1].op) > op_cost(insn.op)) {
+            pred->code[j] = pred->code[j - 1];
+            j--;
+        }
+        pred->code[j] = insn;
+    }
+    pred->needs_stat = pred->xdev || (pred->len > 0 && op_cost(pred->code[pred->len - 1].op) == 3);
+
+    pred->now = time(NULL);
+    if (pred->xdev) {
+        struct stat st;
+        if (stat(root, &st) < 0) {
+            perror(root);
+            return -1;
+        }
+        pred->root_dev = st.st_dev;
+    }
+    return 0;
+}
+
+static int type_bit(unsigned char type) {
+    switch (type) {
+        case DT_LNK: return TYPE_LINK;
+        case DT_DIR: return TYPE_DIR;
+        case DT_REG: return TYPE_FILE;
+        default:     return 0;
+    }
+}
+
+int pred_match(const Predicate *pred, EntryInfo *entry) {
+    for (size_t pc = 0; pc < pred->len; pc++) {
+        const PredInsn *insn = &pred->code[pc];
+        int64_t value;
+
+        switch (insn->op) {
+            case OP_MIN_DEPTH:
+                if (entry->depth < insn->arg)
+                    return 0;
+                continue;
+            case OP_TYPE:
+                if (!(type_bit(entry->type) & insn->arg))
+                    return 0;
+                continue;
+            case OP_NAME:
+                if (fnmatch(insn->pattern, entry->base, 0) != 0)
+                    return 0;
+                continue;
+            case OP_NOT_NAME:
+                if (fnmatch(insn->pattern, entry->base, 0) == 0)
+                    return 0;
+                continue;
+            default:
+                break;
+        }
+
+        if (entry_stat(entry) < 0)
+            return 0;
+        if (insn->op <= OP_SIZE_EQ)
+            value = (int64_t)entry->st.st_size;
+        else
+            value = (int64_t)(pred->now - entry->st.st_mtim.tv_sec) / 60;
+
+        switch (insn->op) {
+            case OP_SIZE_GT: case OP_MMIN_GT:
+                if (!(value > insn->arg))
+                    return 0;
+                break;
+            case OP_SIZE_LT: case OP_MMIN_LT:
+                if (!(value < insn->arg))
+                    return 0;
+                break;
+            default:
+                if (value != insn->arg)
+                    return 0;
+                break;
+        }
+    }
+    return 1;
+}
+
+/* Decided before the directory is opened, so pruned subtrees cost nothing
+ * beyond the entry that names them. */
+int pred_descend(const Predicate *pred, EntryInfo *entry) {
+    if (pred->max_depth >= 0 && entry->depth >= pred->max_depth)
+        return 0;
+    for (size_t i = 0; i < pred->prune_count; i++) {
+        if (fnmatch(pred->prune[i], entry->base, 0) == 0)
+            return 0;
+    }
+    if (pred->xdev) {
+        if (entry_stat(entry) < 0 || entry->st.st_dev != pred->root_dev)
+            return 0;
+    }
+    return 1;
+}
+
+void pred_free(Predicate *pred) {
+    if (!pred)
+        return;
+    free(pred->code);
+    free(pred->prune);
+    free(pred);
+}
@@ -0,0 +1,51 @@
+#ifndef DIRWALK_PREDICATE_H
+#define DIRWALK_PREDICATE_H
+
+#include "dirwalkFunc.h"
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    OP_MIN_DEPTH,
+    OP_TYPE,
+    OP_NAME,
+    OP_NOT_NAME,
+    OP_SIZE_GT,
+    OP_SIZE_LT,
+    OP_SIZE_EQ,
+    OP_MMIN_GT,
+    OP_MMIN_LT,
+    OP_MMIN_EQ,
+} PredOp;
+
+typedef struct {
+    PredOp op;
+    int64_t arg;
+    const char *pattern;
+} PredInsn;
+
+/* Tests are ANDed. pred_compile() orders the program by cost, so the stat
+ * is only issued when every cheaper test has already passed. */
+typedef struct Predicate {
+    PredInsn *code;
+    size_t len;
+    size_t cap;
+    const char **prune;
+    size_t prune_count;
+    size_t prune_cap;
+    int max_depth;
+    int min_depth;
+    int xdev;
+    int needs_stat;
+    dev_t root_dev;
+    time_t now;
+} Predicate;
+
+Predicate *pred_new(void);
+int  pred_parse(Predicate *pred, const char *option, const char *value);
+int  pred_compile(Predicate *pred, const Options *options, int filter, const char *root);
+int  pred_match(const Predicate *pred, EntryInfo *entry);
+int  pred_descend(const Predicate *pred, EntryInfo *entry);
+void pred_free(Predicate *pred);
+
+#endif
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include "dirwalkReader.h"
+#include <errno.h>
+#include <stddef.h>
+
+#define CHUNK_MIN     (16 * 1024)
+#define CHUNK_MAX     (1024 * 1024)
+#define CHUNK_SPARE   8
+#define RECORD_ALIGN  8
+
+/* Freed chunks are kept per thread and handed to the next directory, so a
+ * walk settles on a handful of buffers instead of allocating per directory. */
+static _Thread_local DirChunk *spare_chunks;
+static _Thread_local int spare_count;
+
+static DirChunk *chunk_get(size_t cap) {
+    for (DirChunk **p = &spare_chunks; *p; p = &(*p)->next) {
+        if ((*p)->cap >= cap) {
+            DirChunk *chunk = *p;
+            *p = chunk->next;
+            spare_count--;
+            chunk->next = NULL;
+            chunk->len = 0;
+            return chunk;
+        }
+    }
+    DirChunk *chunk = malloc(sizeof(DirChunk) + cap);
+    if (!chunk)
+        return NULL;
+    chunk->next = NULL;
+    chunk->len = 0;
+    chunk->cap = cap;
+    chunk->external = 0;
+    chunk->data = (char *)(chunk + 1);
+    return chunk;
+}
+
+static void chunk_put(DirChunk *chunk) {
+    if (chunk->external || spare_count >= CHUNK_SPARE) {
+        free(chunk);
+        return;
+    }
+    chunk->next = spare_chunks;
+    spare_chunks = chunk;
+    spare_count++;
+}
+
+static int is_dot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Returns the chunk that still has at least `need` free bytes, growing the
+ * list geometrically so huge directories are read with large buffers. */
+static DirChunk *dir_list_room(DirList *list, size_t need) {
+    if (list->tail && list->tail->cap - list->tail->len >= need)
+        return list->tail;
+
+    size_t cap = list->tail ? list->tail->cap * 2 : CHUNK_MIN;
+    if (cap > CHUNK_MAX)
+        cap = CHUNK_MAX;
+    if (cap < need)
+        cap = need;
+
+    DirChunk *chunk = chunk_get(cap);
+    if (!chunk)
+        return NULL;
+    if (list->tail)
+        list->tail->next = chunk;
+    else
+        list->head = chunk;
+    list->tail = chunk;
+    return chunk;
+}
+
+static void dir_list_count(DirList *list, const DirChunk *chunk, size_t from) {
+    for (size_t pos = from; pos < chunk->len; ) {
+        const DirEntry *entry = (const DirEntry *)(chunk->data + pos);
+        if (!is_dot(entry->name))
+            list->count++;
+        pos += entry->reclen;
+    }
+}
+
+#ifdef __linux__
+
+/* Reads until EOF (returns 0) or until at least `budget` bytes of records
+ * were added to the list (returns 1, the fd is left positioned after them). */
+int dir_list_read_some(int fd, DirList *list, size_t budget) {
+    size_t total = 0;
+    for (;;) {
+        if (total >= budget)
+            return 1;
+        DirChunk *chunk = dir_list_room(list, CHUNK_MIN / 4);
+        if (!chunk)
+            return -1;
+
+        ssize_t n = getdents64(fd, chunk->data + chunk->len, chunk->cap - chunk->len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+
+        size_t from = chunk->len;
+        chunk->len += (size_t)n;
+        total += (size_t)n;
+        dir_list_count(list, chunk, from);
+    }
+}
+
+#else
+
+/* readdir() reads ahead on its own, so without getdents64 the directory
+ * cannot be resumed later: it is always read to the end. */
+int dir_list_read_some(int fd, DirList *list, size_t budget) {
+    (void)budget;
+    return dir_list_read(fd, list);
+}
+
+int dir_list_read(int fd, DirList *list) {
+    int dup_fd = dup(fd);
+    DIR *dir = dup_fd < 0 ? NULL : fdopendir(dup_fd);
+    if (!dir) {
+        if (dup_fd >= 0)
+            close(dup_fd);
+        return -1;
+    }
+
+    struct dirent *ent;
+    errno = 0;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t name_len = strlen(ent->d_name) + 1;
+        size_t reclen = (offsetof(DirEntry, name) + name_len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+        DirChunk *chunk = dir_list_room(list, reclen);
+        if (!chunk) {
+            closedir(dir);
+            return -1;
+        }
+
+        DirEntry *entry = (DirEntry *)(chunk->data + chunk->len);
+        entry->ino = ent->d_ino;
+        entry->off = 0;
+        entry->reclen = (unsigned short)reclen;
+#ifdef DT_UNKNOWN
+        entry->type = ent->d_type;
+#else
+        entry->type = 0;
+#endif
+        memcpy(entry->name, ent->d_name, name_len);
+        chunk->len += reclen;
+        if (!is_dot(entry->name))
+            list->count++;
+        errno = 0;
+    }
+    int err = errno;
+    closedir(dir);
+    errno = err;
+    return err != 0 ? -1 : 0;
+}
+
+#endif
+
+#ifdef __linux__
+
+int dir_list_read(int fd, DirList *list) {
+    return dir_list_read_some(fd, list, SIZE_MAX);
+}
+
+#endif
+
+/* Serves a listing from memory owned by someone else (the mmap'ed cache):
+ * the records are used in place and never returned to the chunk pool. */
+int dir_list_wrap(DirList *list, const char *data, size_t len) {
+    DirChunk *chunk = malloc(sizeof(DirChunk));
+    if (!chunk)
+        return -1;
+    chunk->next = NULL;
+    chunk->len = len;
+    chunk->cap = len;
+    chunk->external = 1;
+    chunk->data = (char *)data;
+    if (list->tail)
+        list->tail->next = chunk;
+    else
+        list->head = chunk;
+    list->tail = chunk;
+    dir_list_count(list, chunk, 0);
+    return 0;
+}
+
+/* Replaces DT_UNKNOWN with the real type, so whoever keeps the listing
+ * (the cache) never has to stat these entries again. */
+void dir_list_resolve_types(DirList *list, int fd) {
+    for (DirChunk *chunk = list->head; chunk; chunk = chunk->next) {
+        if (chunk->external)
+            continue;
+        for (size_t pos = 0; pos < chunk->len; ) {
+            DirEntry *entry = (DirEntry *)(chunk->data + pos);
+            if (entry->type == DT_UNKNOWN && !is_dot(entry->name))
+                entry->type = entry_type(fd, entry->name, DT_UNKNOWN, 0);
+            pos += entry->reclen;
+        }
+    }
+}
+
+#define KEY_INSERTION_SORT 16
+
+static int key_byte(const DirSortKey *k, size_t depth) {
+    return depth < k->key_len ? k->key[depth] : -1;
+}
+
+static int key_cmp_from(const DirSortKey *ka, const DirSortKey *kb, size_t depth) {
+    size_t len = ka->key_len < kb->key_len ? ka->key_len : kb->key_len;
+    int r = depth < len ? memcmp(ka->key + depth, kb->key + depth, len - depth) : 0;
+    if (r == 0 && ka->key_len != kb->key_len)
+        r = ka->key_len < kb->key_len ? -1 : 1;
+    return r != 0 ? r : strcmp(ka->entry->name, kb->entry->name);
+}
+
+static void key_swap(DirSortKey *a, DirSortKey *b) {
+    DirSortKey tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Three-way radix quicksort on the key bytes: shared prefixes are compared
+ * once per level instead of once per comparison. Keys that are equal to the
+ * end fall back to strcmp so the order never depends on the input order. */
+static void key_sort(DirSortKey *a, size_t n, size_t depth) {
+    while (n > KEY_INSERTION_SORT) {
+        key_swap(&a[0], &a[n / 2]);
+        int pivot = key_byte(&a[0], depth);
+        size_t lt = 0, i = 1, gt = n;
+        while (i < gt) {
+            int c = key_byte(&a[i], depth);
+            if (c < pivot)
+                key_swap(&a[lt++], &a[i++]);
+            else if (c > pivot)
+                key_swap(&a[i], &a[--gt]);
+            else
+                i++;
+        }
+
+        key_sort(a, lt, depth);
+        key_sort(a + gt, n - gt, depth);
+        a += lt;
+        n = gt - lt;
+        if (pivot < 0) {
+            depth = SIZE_MAX;
+            break;
+        }
+        depth++;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        for (size_t j = i; j > 0; j--) {
+            int r = depth == SIZE_MAX ? strcmp(a[j - 1].entry->name, a[j].entry->name)
+                                      : key_cmp_from(&a[j - 1], &a[j], depth);
+            if (r <= 0)
+                break;
+            key_swap(&a[j - 1], &a[j]);
+        }
+    }
+}
+
+static int collate_is_bytewise(void) {
+    const char *locale = setlocale(LC_COLLATE, NULL);
+    return !locale || strcmp(locale, "C") == 0 || strcmp(locale, "POSIX") == 0;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+/* Stores the strxfrm key of `name` at `off` in the key arena and returns its
+ * length; memcmp on two keys orders the names exactly like strcoll. */
+static size_t put_key(DirList *list, size_t off, const char *name) {
+    size_t avail = list->keys_cap - off;
+    size_t len = strxfrm((char *)list->keys + off, name, avail);
+    if (len >= avail) {
+        size_t cap = list->keys_cap ? list->keys_cap : 4096;
+        while (cap - off <= len)
+            cap *= 2;
+        list->keys = xrealloc(list->keys, cap);
+        list->keys_cap = cap;
+        strxfrm((char *)list->keys + off, name, cap - off);
+    }
+    return len;
+}
+
+/* Only the sorted mode pays for an index; the records themselves stay where
+ * getdents64 put them. Collation keys are computed once per entry, so the
+ * sort itself works on key bytes instead of O(n log n) strcoll calls. */
+void dir_list_sort(DirList *list) {
+    if (list->count > list->index_cap) {
+        list->index = xrealloc(list->index, list->count * sizeof(*list->index));
+        list->index_cap = list->count;
+    }
+
+    int bytewise = collate_is_bytewise();
+    size_t n = 0;
+    size_t keys_len = 0;
+    DirCursor cursor = {0};
+    const DirEntry *entry;
+    while ((entry = dir_list_next(list, &cursor)) != NULL) {
+        DirSortKey *slot = &list->index[n++];
+        slot->entry = entry;
+        if (bytewise) {
+            slot->key = (const unsigned char *)entry->name;
+            slot->key_len = strlen(entry->name);
+        } else {
+            slot->key_off = keys_len;
+            slot->key_len = put_key(list, keys_len, entry->name);
+            keys_len += slot->key_len + 1;
+        }
+    }
+    if (!bytewise) {
+        for (size_t i = 0; i < n; i++)
+            list->index[i].key = list->keys + list->index[i].key_off;
+    }
+
+    key_sort(list->index, n, 0);
+    list->sorted = 1;
+}
+
+const DirEntry *dir_list_next(const DirList *list, DirCursor *cursor) {
+    if (list->sorted)
+        return cursor->idx < list->count ? list->index[cursor->idx++].entry : NULL;
+
+    if (!cursor->started) {
+        cursor->chunk = list->head;
+        cursor->started = 1;
+    }
+    while (cursor->chunk) {
+        if (cursor->pos >= cursor->chunk->len) {
+            cursor->chunk = cursor->chunk->next;
+            cursor->pos = 0;
+            continue;
+        }
+        const DirEntry *entry = (const DirEntry *)(cursor->chunk->data + cursor->pos);
+        cursor->pos += entry->reclen;
+        if (!is_dot(entry->name))
+            return entry;
+    }
+    return NULL;
+}
+
+void dir_list_free(DirList *list) {
+    DirChunk *chunk = list->head;
+    while (chunk) {
+        DirChunk *next = chunk->next;
+        chunk_put(chunk);
+        chunk = next;
+    }
+    free(list->index);
+    free(list->keys);
+    memset(list, 0, sizeof(*list));
+}
+
+void dir_list_release_spares(void) {
+    while (spare_chunks) {
+        DirChunk *next = spare_chunks->next;
+        free(spare_chunks);
+        spare_chunks = next;
+    }
+    spare_count = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef DIRWALK_READER_H
+#define DIRWALK_READER_H
+
+#include "dirwalkFunc.h"
+#include <stdint.h>
+
+/* Same layout as the kernel's linux_dirent64, so getdents64 output is
+ * iterated in place without copying the records. */
+typedef struct {
+    uint64_t ino;
+    int64_t off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[];
+} DirEntry;
+
+typedef struct DirChunk {
+    struct DirChunk *next;
+    size_t len;
+    size_t cap;
+    int external;
+    char *data;
+} DirChunk;
+
+typedef struct {
+    const DirEntry *entry;
+    union {
+        const unsigned char *key;
+        size_t key_off;
+    };
+    size_t key_len;
+} DirSortKey;
+
+typedef struct {
+    DirChunk *head;
+    DirChunk *tail;
+    size_t count;
+    DirSortKey *index;
+    size_t index_cap;
+    unsigned char *keys;
+    size_t keys_cap;
+    int sorted;
+} DirList;
+
+typedef struct {
+    const DirChunk *chunk;
+    size_t pos;
+    size_t idx;
+    int started;
+} DirCursor;
+
+int  dir_list_read(int fd, DirList *list);
+int  dir_list_read_some(int fd, DirList *list, size_t budget);
+int  dir_list_load(int fd, DirList *list, const Options *options);
+int  dir_list_wrap(DirList *list, const char *data, size_t len);
+void dir_list_resolve_types(DirList *list, int fd);
+void dir_list_sort(DirList *list);
+const DirEntry *dir_list_next(const DirList *list, DirCursor *cursor);
+void dir_list_free(DirList *list);
+void dir_list_release_spares(void);
+
+#endif
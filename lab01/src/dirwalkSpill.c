@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "dirwalkSpill.h"
+#include <errno.h>
+#include <stdint.h>
+
+/* Record: key length (4), name length (2), type (1), key, name. Neither
+ * string is NUL-terminated on disk. */
+#define RECORD_HEADER 7
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+static int write_run(SpillMerge *m, DirList *list) {
+    dir_list_sort(list);
+    SpillRun run = { .off = m->size };
+    unsigned char header[RECORD_HEADER];
+    for (size_t i = 0; i < list->count; i++) {
+        const DirSortKey *k = &list->index[i];
+        uint32_t key_len = (uint32_t)k->key_len;
+        uint16_t name_len = (uint16_t)strlen(k->entry->name);
+        memcpy(header, &key_len, 4);
+        memcpy(header + 4, &name_len, 2);
+        header[6] = k->entry->type;
+        if (fwrite(header, RECORD_HEADER, 1, m->file) != 1 ||
+            fwrite(k->key, 1, key_len, m->file) != key_len ||
+            fwrite(k->entry->name, 1, name_len, m->file) != name_len)
+            return -1;
+        m->size += RECORD_HEADER + key_len + name_len;
+    }
+    run.end = m->size;
+    if (run.end > run.off) {
+        m->runs = xrealloc(m->runs, (m->run_count + 1) * sizeof(SpillRun));
+        m->runs[m->run_count++] = run;
+    }
+    return 0;
+}
+
+/* Makes the whole next record of the run readable at buf + pos. Returns 0
+ * at the end of the run. */
+static int run_fill(SpillMerge *m, SpillRun *r, size_t need) {
+    while (r->len - r->pos < need) {
+        if (r->pos > 0) {
+            memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+            r->len -= r->pos;
+            r->pos = 0;
+        }
+        if (need > r->cap) {
+            r->cap = need > SPILL_READ_BUFFER ? need : SPILL_READ_BUFFER;
+            r->buf = xrealloc(r->buf, r->cap);
+        }
+        size_t want = r->cap - r->len;
+        if ((off_t)want > r->end - r->off)
+            want = (size_t)(r->end - r->off);
+        if (want == 0)
+            return 0;
+        ssize_t n = pread(fileno(m->file), r->buf + r->len, want, r->off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("pread");
+            return 0;
+        }
+        r->len += (size_t)n;
+        r->off += n;
+    }
+    return 1;
+}
+
+static int run_advance(SpillMerge *m, SpillRun *r) {
+    if (!run_fill(m, r, RECORD_HEADER))
+        return 0;
+    uint32_t key_len;
+    uint16_t name_len;
+    memcpy(&key_len, r->buf + r->pos, 4);
+    memcpy(&name_len, r->buf + r->pos + 4, 2);
+    size_t size = RECORD_HEADER + key_len + name_len;
+    if (!run_fill(m, r, size))
+        return 0;
+    r->type = (unsigned char)r->buf[r->pos + 6];
+    r->key = (const unsigned char *)r->buf + r->pos + RECORD_HEADER;
+    r->key_len = key_len;
+    r->name = r->buf + r->pos + RECORD_HEADER + key_len;
+    r->name_len = name_len;
+    r->pos += size;
+    return 1;
+}
+
+/* Same order as dir_list_sort(): collation key, then the name itself. */
+static int run_cmp(const SpillRun *a, const SpillRun *b) {
+    size_t len = a->key_len < b->key_len ? a->key_len : b->key_len;
+    int r = memcmp(a->key, b->key, len);
+    if (r == 0 && a->key_len != b->key_len)
+        return a->key_len < b->key_len ? -1 : 1;
+    if (r != 0)
+        return r;
+    len = a->name_len < b->name_len ? a->name_len : b->name_len;
+    r = memcmp(a->name, b->name, len);
+    if (r == 0 && a->name_len != b->name_len)
+        r = a->name_len < b->name_len ? -1 : 1;
+    return r;
+}
+
+static void heap_down(SpillMerge *m, size_t i) {
+    for (;;) {
+        size_t least = i;
+        size_t l = 2 * i + 1;
+        size_t r = l + 1;
+        if (l < m->heap_len && run_cmp(&m->runs[m->heap[l]], &m->runs[m->heap[least]]) < 0)
+            least = l;
+        if (r < m->heap_len && run_cmp(&m->runs[m->heap[r]], &m->runs[m->heap[least]]) < 0)
+            least = r;
+        if (least == i)
+            return;
+        size_t tmp = m->heap[i];
+        m->heap[i] = m->heap[least];
+        m->heap[least] = tmp;
+        i = least;
+    }
+}
+
+/* Continues reading fd after the first SPILL_RUN_BYTES already in `list`,
+ * sorting and writing each batch as a run. The list is left empty. On -1
+ * the list may be unsorted or partly consumed and must not be used. */
+int spill_directory(SpillMerge *m, int fd, DirList *list) {
+    memset(m, 0, sizeof(*m));
+    if (!(m->file = tmpfile())) {
+        perror("tmpfile");
+        return -1;
+    }
+
+    int more = 1;
+    while (more > 0) {
+        if (write_run(m, list) < 0) {
+            perror("spill");
+            return -1;
+        }
+        dir_list_free(list);
+        more = dir_list_read_some(fd, list, SPILL_RUN_BYTES);
+        if (more < 0) {
+            perror("getdents");
+            return -1;
+        }
+        if (more == 0 && list->count > 0 && write_run(m, list) < 0) {
+            perror("spill");
+            return -1;
+        }
+    }
+    dir_list_free(list);
+    if (fflush(m->file) != 0) {
+        perror("spill");
+        return -1;
+    }
+
+    m->heap = malloc((m->run_count ? m->run_count : 1) * sizeof(size_t));
+    m->current = malloc(sizeof(DirEntry) + NAME_MAX + 1);
+    if (!m->heap || !m->current) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < m->run_count; i++)
+        if (run_advance(m, &m->runs[i]))
+            m->heap[m->heap_len++] = i;
+    for (size_t i = m->heap_len / 2; i-- > 0;)
+        heap_down(m, i);
+    return 0;
+}
+
+const DirEntry *spill_next(SpillMerge *m) {
+    if (m->heap_len == 0)
+        return NULL;
+    SpillRun *r = &m->runs[m->heap[0]];
+    size_t len = r->name_len > NAME_MAX ? NAME_MAX : r->name_len;
+    memcpy(m->current->name, r->name, len);
+    m->current->name[len] = '\0';
+    m->current->type = r->type;
+    m->current->ino = 0;
+    m->current->off = 0;
+    m->current->reclen = 0;
+
+    if (!run_advance(m, r))
+        m->heap[0] = m->heap[--m->heap_len];
+    heap_down(m, 0);
+    return m->current;
+}
+
+void spill_free(SpillMerge *m) {
+    if (m->file)
+        fclose(m->file);
+    for (size_t i = 0; i < m->run_count; i++)
+        free(m->runs[i].buf);
+    free(m->runs);
+    free(m->heap);
+    free(m->current);
+    memset(m, 0, sizeof(*m));
+}
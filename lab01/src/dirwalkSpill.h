@@ -0,0 +1,40 @@
+#ifndef DIRWALK_SPILL_H
+#define DIRWALK_SPILL_H
+
+#include "dirwalkReader.h"
+
+/* Raw getdents bytes sorted in memory before a run goes to disk. */
+#define SPILL_RUN_BYTES   (4 * 1024 * 1024)
+#define SPILL_READ_BUFFER (32 * 1024)
+
+typedef struct {
+    off_t off;
+    off_t end;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t pos;
+    const unsigned char *key;
+    size_t key_len;
+    const char *name;
+    size_t name_len;
+    unsigned char type;
+} SpillRun;
+
+/* A directory too large for one sorted listing: sorted runs in a temporary
+ * file, merged back one entry at a time. */
+typedef struct {
+    FILE *file;
+    off_t size;
+    SpillRun *runs;
+    size_t run_count;
+    size_t *heap;
+    size_t heap_len;
+    DirEntry *current;
+} SpillMerge;
+
+int  spill_directory(SpillMerge *m, int fd, DirList *list);
+const DirEntry *spill_next(SpillMerge *m);
+void spill_free(SpillMerge *m);
+
+#endif
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include "dirwalkUring.h"
+#include "dirwalkPredicate.h"
+#include <errno.h>
+#include <stdatomic.h>
+
+void stat_batch_free(StatBatch *batch) {
+    free(batch->st);
+    free(batch->ok);
+    memset(batch, 0, sizeof(*batch));
+}
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/* One ring per thread, set up on first use. The statx buffers belong to
+ * the ring: a request can only be in flight while it holds a slot. */
+typedef struct {
+    int fd;
+    int broken;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_len;
+    size_t cq_map_len;
+    size_t sqes_len;
+    size_t inflight;
+    struct statx bufs[STAT_RING_ENTRIES];
+    size_t owner[STAT_RING_ENTRIES];
+    unsigned free_slots[STAT_RING_ENTRIES];
+    unsigned free_count;
+} StatRing;
+
+static int stat_wanted(const Options *options) {
+    return options->du || options->dupes || (options->pred && options->pred->needs_stat);
+}
+
+static void batch_alloc(StatBatch *batch, size_t count) {
+    batch->st = malloc((count ? count : 1) * sizeof(struct stat));
+    batch->ok = calloc(count ? count : 1, 1);
+    if (!batch->st || !batch->ok) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static _Thread_local StatRing *ring;
+static atomic_int ring_unavailable;
+
+static void ring_disable(const char *why, int err) {
+    if (!atomic_exchange(&ring_unavailable, 1))
+        fprintf(stderr, "dirwalk: %s (%s), using synchronous stat\n", why, strerror(err));
+}
+
+static void ring_unmap(StatRing *r) {
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map && r->sq_map != MAP_FAILED)
+        munmap(r->sq_map, r->sq_map_len);
+}
+
+static StatRing *ring_get(void) {
+    if (ring)
+        return ring->broken ? NULL : ring;
+    if (atomic_load(&ring_unavailable))
+        return NULL;
+
+    StatRing *r = calloc(1, sizeof(StatRing));
+    if (!r) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, STAT_RING_ENTRIES, &p);
+    if (r->fd < 0) {
+        ring_disable("io_uring unavailable", errno);
+        free(r);
+        return NULL;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_len > r->sq_map_len)
+            r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map != MAP_FAILED) {
+        r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_map :
+                    mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+    }
+    if (r->sq_map != MAP_FAILED && r->cq_map != MAP_FAILED) {
+        r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       r->fd, IORING_OFF_SQES);
+    }
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        ring_disable("io_uring mmap failed", errno);
+        ring_unmap(r);
+        close(r->fd);
+        free(r);
+        return NULL;
+    }
+
+    char *sq = r->sq_map;
+    char *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    for (unsigned i = 0; i < STAT_RING_ENTRIES; i++)
+        r->free_slots[r->free_count++] = STAT_RING_ENTRIES - 1 - i;
+
+    ring = r;
+    return r;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size = (off_t)stx->stx_size;
+    st->st_blksize = stx->stx_blksize;
+    st->st_blocks = (blkcnt_t)stx->stx_blocks;
+    st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+static void ring_reap(StatRing *r, StatBatch *batch) {
+    unsigned head = *r->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)r->cq_tail, memory_order_acquire);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        unsigned slot = (unsigned)cqe->user_data;
+        size_t i = r->owner[slot];
+        if (cqe->res == 0) {
+            statx_to_stat(&r->bufs[slot], &batch->st[i]);
+            batch->ok[i] = 1;
+        } else if (cqe->res == -EINVAL) {
+            /* No IORING_OP_STATX in this kernel. */
+            r->broken = 1;
+            ring_disable("io_uring statx unsupported", EINVAL);
+        }
+        r->free_slots[r->free_count++] = slot;
+        r->inflight--;
+    }
+    atomic_store_explicit((_Atomic unsigned *)r->cq_head, head, memory_order_release);
+}
+
+/* After a failed submit: takes back the requests the kernel never saw and
+ * waits out the ones it did, so no statx is left reading names from a
+ * DirList the caller is about to free. */
+static void ring_drain(StatRing *r, StatBatch *batch) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)r->sq_head, memory_order_acquire);
+    unsigned tail = *r->sq_tail;
+    for (; tail != head; tail--) {
+        r->free_slots[r->free_count++] = (unsigned)r->sqes[(tail - 1) & *r->sq_mask].user_data;
+        r->inflight--;
+    }
+    atomic_store_explicit((_Atomic unsigned *)r->sq_tail, tail, memory_order_release);
+
+    while (r->inflight) {
+        if (syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            exit(EXIT_FAILURE);
+        }
+        ring_reap(r, batch);
+    }
+}
+
+/* Keeps up to STAT_RING_ENTRIES statx requests in flight and refills the
+ * ring as completions come back, so a slow (network, cold) filesystem sees
+ * a queue of lookups instead of one at a time. Entries whose stat nobody
+ * will ask for are not sent: with d_type known and no stat-based option,
+ * the batch is empty. */
+int stat_batch_collect(StatBatch *batch, int dirfd, const DirList *list, const Options *options) {
+    memset(batch, 0, sizeof(*batch));
+    StatRing *r = ring_get();
+    if (!r)
+        return -1;
+
+    int all = stat_wanted(options);
+    int follow = options->follow_links;
+    batch_alloc(batch, list->count);
+    batch->count = list->count;
+
+    DirCursor cursor = {0};
+    size_t idx = 0;
+    int more = 1;
+    unsigned tail = *r->sq_tail;
+    while (more || r->inflight) {
+        unsigned queued = 0;
+        while (more && !r->broken && r->free_count > 0) {
+            const DirEntry *entry = dir_list_next(list, &cursor);
+            if (!entry) {
+                more = 0;
+                break;
+            }
+            size_t i = idx++;
+            if (!all && entry->type != DT_UNKNOWN &&
+                !(follow && (entry->type == DT_LNK || entry->type == DT_DIR)))
+                continue;
+
+            unsigned slot = r->free_slots[--r->free_count];
+            r->owner[slot] = i;
+            unsigned pos = tail & *r->sq_mask;
+            struct io_uring_sqe *sqe = &r->sqes[pos];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            /* A statx that misses the dcache would be retried from a
+             * worker anyway; going there directly trades the rare inline
+             * completion for one less failed attempt per entry. */
+            sqe->flags = IOSQE_ASYNC;
+            sqe->fd = dirfd;
+            sqe->addr = (uint64_t)(uintptr_t)entry->name;
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uint64_t)(uintptr_t)&r->bufs[slot];
+            sqe->statx_flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+            sqe->user_data = slot;
+            r->sq_array[pos] = pos;
+            tail++;
+            queued++;
+        }
+        if (r->broken && !r->inflight && !queued)
+            break;
+        if (queued)
+            atomic_store_explicit((_Atomic unsigned *)r->sq_tail, tail, memory_order_release);
+        r->inflight += queued;
+        if (!r->inflight)
+            break;
+
+        unsigned submit = tail - atomic_load_explicit((_Atomic unsigned *)r->sq_head, memory_order_acquire);
+        if (syscall(__NR_io_uring_enter, r->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            r->broken = 1;
+            ring_drain(r, batch);
+            break;
+        }
+        ring_reap(r, batch);
+    }
+    return 0;
+}
+
+/* Requests are always drained before stat_batch_collect() returns; the
+ * check only guards against freeing a ring under the kernel's feet. */
+void stat_batch_release(void) {
+    if (!ring)
+        return;
+    if (ring->inflight == 0) {
+        ring_unmap(ring);
+        close(ring->fd);
+        free(ring);
+    }
+    ring = NULL;
+}
+
+#else
+
+int stat_batch_collect(StatBatch *batch, int dirfd, const DirList *list, const Options *options) {
+    (void)dirfd;
+    (void)list;
+    (void)options;
+    memset(batch, 0, sizeof(*batch));
+    return -1;
+}
+
+void stat_batch_release(void) {
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef DIRWALK_URING_H
+#define DIRWALK_URING_H
+
+#include "dirwalkReader.h"
+
+#define STAT_RING_ENTRIES 64
+
+/* Stats of one directory's entries, indexed in dir_list_next() order.
+ * `ok[i]` is 0 where the entry was not requested or the statx failed; the
+ * walker then falls back to a synchronous entry_stat(). */
+typedef struct {
+    struct stat *st;
+    unsigned char *ok;
+    size_t count;
+} StatBatch;
+
+int  stat_batch_collect(StatBatch *batch, int dirfd, const DirList *list, const Options *options);
+void stat_batch_free(StatBatch *batch);
+void stat_batch_release(void);
+
+#endif
@@ -0,0 +1,521 @@
+#define _GNU_SOURCE
+#include "dirwalkWatch.h"
+#include "dirwalkReader.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK          (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK)
+#define WATCH_EVENT_BUFFER  (64 * 1024)
+#define WATCH_MOVE_WAIT_MS  100
+#define WATCH_TABLE_INITIAL 1024
+#define WATCH_ARENA_INITIAL (64 * 1024)
+
+typedef uint64_t (*NodeHash)(const WatchState *w, uint32_t node);
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t key_hash_wd(int wd) {
+    return mix64((uint64_t)(uint32_t)wd);
+}
+
+static uint64_t key_hash_name(uint32_t parent, const char *name, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ parent;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+    return mix64(h);
+}
+
+static uint64_t hash_wd(const WatchState *w, uint32_t n) {
+    return key_hash_wd(w->nodes[n].wd);
+}
+
+static uint64_t hash_name(const WatchState *w, uint32_t n) {
+    const WatchNode *node = &w->nodes[n];
+    return key_hash_name(node->parent, w->names + node->name_off, node->name_len);
+}
+
+/* Both indexes are open-addressing tables of node numbers (+1, so 0 is an
+ * empty slot): 4 bytes per slot, the key itself lives in the node. */
+static void table_put(WatchState *w, WatchTable *t, uint32_t n, NodeHash hash) {
+    size_t mask = t->cap - 1;
+    size_t i = hash(w, n) & mask;
+    while (t->slots[i])
+        i = (i + 1) & mask;
+    t->slots[i] = n + 1;
+    t->count++;
+}
+
+static void table_insert(WatchState *w, WatchTable *t, uint32_t n, NodeHash hash) {
+    if ((t->count + 1) * 4 > t->cap * 3) {
+        uint32_t *old = t->slots;
+        size_t old_cap = t->cap;
+        t->cap = old_cap ? old_cap * 2 : WATCH_TABLE_INITIAL;
+        t->slots = calloc(t->cap, sizeof(uint32_t));
+        if (!t->slots) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        t->count = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i])
+                table_put(w, t, old[i] - 1, hash);
+        }
+        free(old);
+    }
+    table_put(w, t, n, hash);
+}
+
+/* Backward-shift deletion keeps probe runs intact without tombstones. */
+static void table_remove(WatchState *w, WatchTable *t, uint32_t n, NodeHash hash) {
+    if (!t->cap)
+        return;
+    size_t mask = t->cap - 1;
+    size_t i = hash(w, n) & mask;
+    while (t->slots[i] && t->slots[i] != n + 1)
+        i = (i + 1) & mask;
+    if (!t->slots[i])
+        return;
+
+    t->slots[i] = 0;
+    t->count--;
+    for (size_t j = (i + 1) & mask; t->slots[j]; j = (j + 1) & mask) {
+        size_t home = hash(w, t->slots[j] - 1) & mask;
+        int stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            t->slots[i] = t->slots[j];
+            t->slots[j] = 0;
+            i = j;
+        }
+    }
+}
+
+static uint32_t wd_find(const WatchState *w, int wd) {
+    if (!w->by_wd.cap)
+        return WATCH_NONE;
+    size_t mask = w->by_wd.cap - 1;
+    for (size_t i = key_hash_wd(wd) & mask; w->by_wd.slots[i]; i = (i + 1) & mask) {
+        uint32_t n = w->by_wd.slots[i] - 1;
+        if (w->nodes[n].wd == wd)
+            return n;
+    }
+    return WATCH_NONE;
+}
+
+static uint32_t name_find(const WatchState *w, uint32_t parent, const char *name, size_t len) {
+    if (!w->by_name.cap)
+        return WATCH_NONE;
+    size_t mask = w->by_name.cap - 1;
+    for (size_t i = key_hash_name(parent, name, len) & mask; w->by_name.slots[i]; i = (i + 1) & mask) {
+        const WatchNode *node = &w->nodes[w->by_name.slots[i] - 1];
+        if (node->parent == parent && node->name_len == len &&
+            memcmp(w->names + node->name_off, name, len) == 0)
+            return w->by_name.slots[i] - 1;
+    }
+    return WATCH_NONE;
+}
+
+/* Names of renamed and removed directories stay in the arena as garbage
+ * until it outweighs the live names. */
+static void names_compact(WatchState *w) {
+    char *names = malloc(w->names_cap);
+    if (!names) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = 0;
+    for (uint32_t n = 0; n < w->node_count; n++) {
+        WatchNode *node = &w->nodes[n];
+        if (node->wd < 0)
+            continue;
+        memcpy(names + len, w->names + node->name_off, node->name_len);
+        node->name_off = (uint32_t)len;
+        len += node->name_len;
+    }
+    free(w->names);
+    w->names = names;
+    w->names_len = len;
+    w->names_dead = 0;
+}
+
+static void name_store(WatchState *w, uint32_t n, const char *name, size_t len) {
+    if (w->names_dead > WATCH_ARENA_INITIAL && w->names_dead > w->names_len / 2)
+        names_compact(w);
+    if (w->names_len + len > w->names_cap) {
+        size_t cap = w->names_cap ? w->names_cap : WATCH_ARENA_INITIAL;
+        while (w->names_len + len > cap)
+            cap *= 2;
+        w->names = xrealloc(w->names, cap);
+        w->names_cap = cap;
+    }
+    memcpy(w->names + w->names_len, name, len);
+    w->nodes[n].name_off = (uint32_t)w->names_len;
+    w->nodes[n].name_len = (uint16_t)len;
+    w->names_len += len;
+}
+
+static uint32_t node_new(WatchState *w, int wd, uint32_t parent, const char *name, size_t len) {
+    uint32_t n;
+    if (w->free_head != WATCH_NONE) {
+        n = w->free_head;
+        w->free_head = w->nodes[n].parent;
+    } else {
+        if (w->node_count == w->node_cap) {
+            w->node_cap = w->node_cap ? w->node_cap * 2 : WATCH_TABLE_INITIAL;
+            w->nodes = xrealloc(w->nodes, w->node_cap * sizeof(WatchNode));
+        }
+        n = w->node_count++;
+    }
+
+    WatchNode *node = &w->nodes[n];
+    node->wd = wd;
+    node->parent = parent;
+    node->children = 0;
+    node->name_off = 0;
+    node->name_len = 0;
+    name_store(w, n, name, len);
+    table_insert(w, &w->by_wd, n, hash_wd);
+    if (parent != WATCH_NONE) {
+        table_insert(w, &w->by_name, n, hash_name);
+        w->nodes[parent].children++;
+    }
+    w->live++;
+    return n;
+}
+
+static void node_remove(WatchState *w, uint32_t n) {
+    WatchNode *node = &w->nodes[n];
+    table_remove(w, &w->by_wd, n, hash_wd);
+    if (node->parent != WATCH_NONE) {
+        table_remove(w, &w->by_name, n, hash_name);
+        if (w->nodes[node->parent].wd >= 0)
+            w->nodes[node->parent].children--;
+    }
+    w->names_dead += node->name_len;
+    node->wd = -1;
+    node->parent = w->free_head;
+    w->free_head = n;
+    w->live--;
+}
+
+static uint32_t *chain_reserve(WatchState *w, size_t need) {
+    if (need > w->chain_cap) {
+        w->chain_cap = need * 2;
+        w->chain = xrealloc(w->chain, w->chain_cap * sizeof(uint32_t));
+    }
+    return w->chain;
+}
+
+/* Rebuilds "root/a/b[/name]" into w->path; 0 if it does not fit. */
+static size_t node_path(WatchState *w, uint32_t n, const char *name) {
+    size_t depth = 0;
+    for (uint32_t p = n; w->nodes[p].parent != WATCH_NONE; p = w->nodes[p].parent) {
+        chain_reserve(w, depth + 1)[depth] = p;
+        depth++;
+    }
+
+    size_t len = w->root_len;
+    memcpy(w->path, w->root, len);
+    while (depth > 0) {
+        const WatchNode *node = &w->nodes[w->chain[--depth]];
+        if (len + node->name_len + 1 >= sizeof(w->path))
+            return 0;
+        memcpy(w->path + len, w->names + node->name_off, node->name_len);
+        len += node->name_len;
+        w->path[len++] = '/';
+    }
+    if (name) {
+        size_t name_len = strlen(name);
+        if (len + name_len >= sizeof(w->path))
+            return 0;
+        memcpy(w->path + len, name, name_len);
+        len += name_len;
+    } else if (len > 1) {
+        len--;
+    }
+    w->path[len] = '\0';
+    return len;
+}
+
+/* Drops the watches of a directory that left the tree (moved out, or
+ * unmounted) together with everything registered below it. */
+static void watch_drop(WatchState *w, uint32_t top) {
+    unsigned char *mark = calloc(w->node_count, 1);
+    if (!mark) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    mark[top] = 1;
+    for (uint32_t n = 0; n < w->node_count; n++) {
+        if (w->nodes[n].wd < 0 || mark[n])
+            continue;
+        size_t depth = 0;
+        uint32_t p = n;
+        while (!mark[p] && w->nodes[p].parent != WATCH_NONE) {
+            chain_reserve(w, depth + 1)[depth] = p;
+            depth++;
+            p = w->nodes[p].parent;
+        }
+        unsigned char state = mark[p] == 1 ? 1 : 2;
+        while (depth > 0)
+            mark[w->chain[--depth]] = state;
+        if (!mark[p])
+            mark[p] = 2;
+    }
+    for (uint32_t n = 0; n < w->node_count; n++) {
+        if (mark[n] == 1 && w->nodes[n].wd >= 0) {
+            inotify_rm_watch(w->fd, w->nodes[n].wd);
+            node_remove(w, n);
+        }
+    }
+    free(mark);
+}
+
+static uint32_t watch_register(WatchState *w, uint32_t parent, const char *name, const char *path) {
+    uint32_t mask = WATCH_MASK | (w->follow ? 0 : IN_DONT_FOLLOW);
+    int wd = inotify_add_watch(w->fd, path, mask);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            if (!w->limit_warned)
+                fprintf(stderr, "dirwalk: inotify watch limit reached (fs.inotify.max_user_watches)\n");
+            w->limit_warned = 1;
+        } else if (errno != ENOENT && errno != ENOTDIR) {
+            perror(path);
+        }
+        return WATCH_NONE;
+    }
+    /* The same directory reached twice (-L, bind mounts) keeps one watch. */
+    uint32_t n = wd_find(w, wd);
+    return n != WATCH_NONE ? n : node_new(w, wd, parent, name, strlen(name));
+}
+
+WatchState *watch_new(const Options *options, int filter) {
+    WatchState *w = calloc(1, sizeof(WatchState));
+    if (!w) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    w->fd = inotify_init1(IN_CLOEXEC);
+    if (w->fd < 0) {
+        perror("inotify_init1");
+        free(w);
+        return NULL;
+    }
+    w->options = options;
+    w->follow = options->follow_links;
+    w->filter = filter;
+    w->free_head = WATCH_NONE;
+    output_init(&w->out, STDOUT_FILENO, options->separator, NULL);
+    return w;
+}
+
+uint32_t watch_root(WatchState *w, const char *path) {
+    w->root_len = dir_prefix(w->root, sizeof(w->root), path);
+    if (w->root_len == 0)
+        return WATCH_NONE;
+    return watch_register(w, WATCH_NONE, "", path);
+}
+
+uint32_t watch_add(WatchState *w, uint32_t parent, const char *name, const char *path) {
+    if (parent == WATCH_NONE)
+        return WATCH_NONE;
+    return watch_register(w, parent, name, path);
+}
+
+/* Deleted entries cannot be stat'ed any more: apart from directories
+ * (IN_ISDIR) their type is unknown and they pass both -f and -l. */
+static int event_matches(const WatchState *w, const char *path, int isdir) {
+    const Options *options = w->options;
+    if (!w->filter)
+        return 1;
+    if (isdir)
+        return options->show_dirs;
+    struct stat st;
+    if (lstat(path, &st) < 0)
+        return options->show_files || options->show_links;
+    return (options->show_links && S_ISLNK(st.st_mode)) ||
+           (options->show_files && S_ISREG(st.st_mode));
+}
+
+static void emit(WatchState *w, const char *tag, size_t len, int isdir) {
+    if (!event_matches(w, w->path, isdir))
+        return;
+    output_bytes(&w->out, tag, strlen(tag));
+    output_bytes(&w->out, "\t", 1);
+    output_path(&w->out, w->path, len);
+}
+
+/* A directory that appears after the initial walk may already have
+ * contents by the time its watch exists: those are reported as created. */
+static void watch_scan(WatchState *w, uint32_t node, size_t len) {
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (w->follow ? 0 : O_NOFOLLOW);
+    int fd = open(w->path, flags);
+    if (fd < 0)
+        return;
+    DirList list = {0};
+    if (dir_list_read(fd, &list) == 0) {
+        DirCursor cursor = {0};
+        const DirEntry *entry;
+        while ((entry = dir_list_next(&list, &cursor)) != NULL) {
+            size_t name_len = strlen(entry->name);
+            if (len + name_len + 2 >= sizeof(w->path))
+                continue;
+            w->path[len] = '/';
+            memcpy(w->path + len + 1, entry->name, name_len + 1);
+            size_t child_len = len + 1 + name_len;
+            int isdir = entry_type(fd, entry->name, entry->type, w->follow) == DT_DIR;
+            emit(w, "create", child_len, isdir);
+            if (isdir) {
+                uint32_t child = watch_add(w, node, entry->name, w->path);
+                if (child != WATCH_NONE)
+                    watch_scan(w, child, child_len);
+            }
+        }
+    }
+    w->path[len] = '\0';
+    dir_list_free(&list);
+    close(fd);
+}
+
+static void watch_appeared(WatchState *w, uint32_t parent, const char *name, size_t len) {
+    uint32_t node = watch_add(w, parent, name, w->path);
+    if (node != WATCH_NONE)
+        watch_scan(w, node, len);
+}
+
+/* IN_MOVED_FROM of a directory waits for the IN_MOVED_TO with the same
+ * cookie; if none follows, the directory left the watched tree. */
+static void watch_settle(WatchState *w) {
+    if (!w->pending)
+        return;
+    w->pending = 0;
+    if (w->nodes[w->pending_node].wd >= 0)
+        watch_drop(w, w->pending_node);
+}
+
+static void watch_rename(WatchState *w, uint32_t n, uint32_t parent, const char *name) {
+    WatchNode *node = &w->nodes[n];
+    table_remove(w, &w->by_name, n, hash_name);
+    w->nodes[node->parent].children--;
+    w->names_dead += node->name_len;
+    node->parent = parent;
+    name_store(w, n, name, strlen(name));
+    table_insert(w, &w->by_name, n, hash_name);
+    w->nodes[parent].children++;
+}
+
+static void watch_event(WatchState *w, const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        fprintf(stderr, "dirwalk: inotify queue overflow, events were lost\n");
+        return;
+    }
+    int paired = (ev->mask & IN_MOVED_TO) && w->pending && ev->cookie == w->pending_cookie;
+    if (!paired)
+        watch_settle(w);
+
+    uint32_t node = wd_find(w, ev->wd);
+    if (node == WATCH_NONE)
+        return;
+    if (ev->mask & IN_IGNORED) {
+        if (w->nodes[node].children > 0)
+            watch_drop(w, node);
+        else
+            node_remove(w, node);
+        return;
+    }
+    if (ev->len == 0)
+        return;
+
+    int isdir = (ev->mask & IN_ISDIR) != 0;
+    size_t len = node_path(w, node, ev->name);
+    if (len == 0)
+        return;
+
+    if (ev->mask & IN_CREATE) {
+        emit(w, "create", len, isdir);
+        if (isdir)
+            watch_appeared(w, node, ev->name, len);
+    } else if (ev->mask & IN_DELETE) {
+        emit(w, "delete", len, isdir);
+    } else if (ev->mask & IN_MOVED_FROM) {
+        emit(w, "moved_from", len, isdir);
+        uint32_t child = isdir ? name_find(w, node, ev->name, strlen(ev->name)) : WATCH_NONE;
+        if (child != WATCH_NONE) {
+            w->pending = 1;
+            w->pending_cookie = ev->cookie;
+            w->pending_node = child;
+        }
+    } else if (ev->mask & IN_MOVED_TO) {
+        emit(w, "moved_to", len, isdir);
+        if (paired) {
+            w->pending = 0;
+            if (w->nodes[w->pending_node].wd >= 0)
+                watch_rename(w, w->pending_node, node, ev->name);
+        } else if (isdir) {
+            watch_appeared(w, node, ev->name, len);
+        }
+    }
+}
+
+/* Runs until every watch is gone (the root was removed) or a read fails. */
+void watch_run(WatchState *w) {
+    _Alignas(struct inotify_event) char buf[WATCH_EVENT_BUFFER];
+    while (w->live > 0) {
+        struct pollfd pfd = { .fd = w->fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, w->pending ? WATCH_MOVE_WAIT_MS : -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (ready == 0) {
+            watch_settle(w);
+            continue;
+        }
+
+        ssize_t n = read(w->fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("read");
+            break;
+        }
+        for (ssize_t pos = 0; pos < n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)(buf + pos);
+            watch_event(w, ev);
+            pos += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+        }
+        output_flush(&w->out);
+    }
+    output_flush(&w->out);
+}
+
+void watch_free(WatchState *w) {
+    if (!w)
+        return;
+    output_free(&w->out);
+    close(w->fd);
+    free(w->nodes);
+    free(w->names);
+    free(w->by_wd.slots);
+    free(w->by_name.slots);
+    free(w->chain);
+    free(w);
+}
@@ -0,0 +1,61 @@
+#ifndef DIRWALK_WATCH_H
+#define DIRWALK_WATCH_H
+
+#include "dirwalkFunc.h"
+#include "dirwalkOutput.h"
+#include <stdint.h>
+
+#define WATCH_NONE UINT32_MAX
+
+/* A watched directory is its parent's node index plus its own name, not a
+ * full path: ~20 bytes plus the name, and renaming a directory is one
+ * update no matter how many watched directories sit below it. */
+typedef struct {
+    int wd;
+    uint32_t parent;
+    uint32_t children;
+    uint32_t name_off;
+    uint16_t name_len;
+} WatchNode;
+
+typedef struct {
+    uint32_t *slots;
+    size_t cap;
+    size_t count;
+} WatchTable;
+
+typedef struct WatchState {
+    int fd;
+    int follow;
+    int filter;
+    const Options *options;
+    char root[PATH_MAX];
+    size_t root_len;
+    WatchNode *nodes;
+    uint32_t node_count;
+    uint32_t node_cap;
+    uint32_t free_head;
+    size_t live;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    size_t names_dead;
+    WatchTable by_wd;
+    WatchTable by_name;
+    uint32_t *chain;
+    size_t chain_cap;
+    int limit_warned;
+    int pending;
+    uint32_t pending_cookie;
+    uint32_t pending_node;
+    OutputBuffer out;
+    char path[PATH_MAX];
+} WatchState;
+
+WatchState *watch_new(const Options *options, int filter);
+uint32_t watch_root(WatchState *w, const char *path);
+uint32_t watch_add(WatchState *w, uint32_t parent, const char *name, const char *path);
+void watch_run(WatchState *w);
+void watch_free(WatchState *w);
+
+#endif
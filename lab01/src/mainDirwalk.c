@@ -1,35 +1,184 @@
-#include "dirwalkFunc.h"
+
+#include "dirwalkLib.h"
+#include "dirwalkParallel.h"
+#include "dirwalkBounded.h"
+#include "dirwalkCache.h"
+#include "dirwalkPredicate.h"
+#include "dirwalkDu.h"
+#include "dirwalkDupes.h"
+#include "dirwalkInodeSet.h"
+#include "dirwalkWatch.h"
+#include "dirwalkEstimate.h"
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [dir] [-l] [-d] [-f] [-s] [-L] [-0] [-j N] [--cache FILE]\n"
+	        "       [--name GLOB] [--prune GLOB] [--size [+-]N[ckMG]] [--mmin [+-]N]\n"
+	        "       [--maxdepth N] [--mindepth N] [--xdev] [--du [--top N]] [--dupes]\n"
+	        "       [--max-fds N] [--stream] [--uring] [--watch]\n"
+	        "       [--estimate [--probes N]]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int parse_jobs(const char *value, const char *prog) {
+	char *end;
+	long jobs = value ? strtol(value, &end, 10) : 0;
+	if (!value || *end != '\0' || jobs < 1 || jobs > MAX_JOBS) {
+		fprintf(stderr, "%s: -j expects a number of threads in 1..%d\n", prog, MAX_JOBS);
+		usage(prog);
+	}
+	return (int)jobs;
+}
 
 int main(int argc, char *argv[]) {
-	Options options = {0, 0, 0, 0};
+	Options options;
 	int filter = 0;
 	const char *path = ".";
+	const char *cache_path = NULL;
+	Predicate *pred = NULL;
+	int du = 0;
+	int dupes = 0;
+	int watch = 0;
+	int stream = 0;
+	int estimate = 0;
+	long probes = ESTIMATE_DEFAULT_PROBES;
+	long top = DU_DEFAULT_TOP;
 
+	dirwalk_options_init(&options);
 	setlocale(LC_COLLATE, "");
 
 	for (int i = 1; i < argc; i++) {
-		if (argv[i][0] == '-') {
+		if (strcmp(argv[i], "--cache") == 0) {
+			if (i + 1 >= argc)
+				usage(argv[0]);
+			cache_path = argv[++i];
+		} else if (strcmp(argv[i], "--max-fds") == 0) {
+			char *end;
+			long fds = i + 1 < argc ? strtol(argv[++i], &end, 10) : -1;
+			if (fds < BOUNDED_MIN_FDS || fds > INT_MAX || *end != '\0') {
+				fprintf(stderr, "%s: --max-fds expects a number >= %d\n", argv[0], BOUNDED_MIN_FDS);
+				usage(argv[0]);
+			}
+			options.max_fds = (int)fds;
+		} else if (strcmp(argv[i], "--stream") == 0) {
+			stream = 1;
+		} else if (strcmp(argv[i], "--estimate") == 0) {
+			estimate = 1;
+		} else if (strcmp(argv[i], "--probes") == 0) {
+			char *end;
+			probes = i + 1 < argc ? strtol(argv[++i], &end, 10) : -1;
+			if (probes <= 0 || *end != '\0')
+				usage(argv[0]);
+		} else if (strcmp(argv[i], "--watch") == 0) {
+			watch = 1;
+		} else if (strcmp(argv[i], "--uring") == 0) {
+			options.uring = 1;
+		} else if (strcmp(argv[i], "--du") == 0) {
+			du = 1;
+		} else if (strcmp(argv[i], "--dupes") == 0) {
+			dupes = 1;
+		} else if (strcmp(argv[i], "--top") == 0) {
+			char *end;
+			top = i + 1 < argc ? strtol(argv[++i], &end, 10) : -1;
+			if (top < 0 || *end != '\0')
+				usage(argv[0]);
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			if (!pred)
+				pred = pred_new();
+			int taken = pred_parse(pred, argv[i], i + 1 < argc ? argv[i + 1] : NULL);
+			if (taken < 0) {
+				fprintf(stderr, "%s: bad option or value: %s\n", argv[0], argv[i]);
+				usage(argv[0]);
+			}
+			i += taken;
+		} else if (argv[i][0] == '-') {
 			for (int j = 1; argv[i][j] != '\0'; j++) {
 				switch (argv[i][j]) {
 					case 'l': options.show_links = 1; filter = 1; break;
 					case 'd': options.show_dirs = 1; filter = 1; break;
 					case 'f': options.show_files = 1; filter = 1; break;
 					case 's': options.sort_output = 1; break;
+					case 'L': options.follow_links = 1; break;
+					case '0': options.separator = '\0'; break;
+					case 'j':
+						if (argv[i][j + 1] != '\0')
+							options.jobs = parse_jobs(&argv[i][j + 1], argv[0]);
+						else
+							options.jobs = parse_jobs(i + 1 < argc ? argv[++i] : NULL, argv[0]);
+						goto next_arg;
 					default:
-						fprintf(stderr, "Usage: %s [dir] [-l] [-d] [-f] [-s]\n", argv[0]);
-						exit(EXIT_FAILURE);
+						usage(argv[0]);
 				}
 			}
 		} else {
 			path = argv[i];
 		}
+next_arg:;
 	}
 
-	if (options.show_dirs || !filter) {
-		printf("%s\n", path);
+	if (pred) {
+		if (pred_compile(pred, &options, filter, path) < 0)
+			exit(EXIT_FAILURE);
+		options.pred = pred;
+	}
+	if (cache_path)
+		options.cache = cache_open(cache_path);
+	if (du && dupes) {
+		fprintf(stderr, "%s: --du and --dupes are mutually exclusive\n", argv[0]);
+		usage(argv[0]);
 	}
+	if (stream && !options.max_fds)
+		options.max_fds = BOUNDED_STREAM_FDS;
+	if (options.max_fds && options.jobs > 1) {
+		fprintf(stderr, "%s: --max-fds and --stream work with a single thread only\n", argv[0]);
+		usage(argv[0]);
+	}
+	if (options.uring && options.max_fds) {
+		fprintf(stderr, "%s: --uring does not work with --max-fds or --stream\n", argv[0]);
+		usage(argv[0]);
+	}
+	if (options.follow_links && options.sort_output && options.jobs > 1) {
+		fprintf(stderr, "%s: -L with -s needs a single thread: with -j the path a directory is walked through depends on thread timing\n", argv[0]);
+		usage(argv[0]);
+	}
+	if (watch && (du || dupes || options.jobs > 1 || options.max_fds)) {
+		fprintf(stderr, "%s: --watch needs the plain serial walk (no -j, --max-fds, --stream, --du, --dupes)\n", argv[0]);
+		usage(argv[0]);
+	}
+	if (estimate && (du || dupes || watch || filter || pred || cache_path || options.sort_output ||
+	                 options.follow_links || options.separator == '\0' || options.jobs > 1 ||
+	                 options.max_fds || options.uring)) {
+		fprintf(stderr, "%s: --estimate only takes --probes (no --du, --dupes, --watch, -l, -d, -f, -s, -L, -0, -j,\n"
+		        "    --max-fds, --stream, --uring, --cache or predicates)\n", argv[0]);
+		usage(argv[0]);
+	}
+	if (watch && !(options.watch = watch_new(&options, filter)))
+		exit(EXIT_FAILURE);
+	InodeSet visited;
+	if (options.follow_links) {
+		inode_set_init_lockfree(&visited, INODE_FAST_SLOTS);
+		options.visited = &visited;
+	}
+	if (du)
+		options.du = du_new((size_t)top);
+	if (dupes)
+		options.dupes = dupes_new(options.jobs);
 
-	walk_directory(path, &options, filter);
+	if (estimate)
+		estimate_tree(path, &options, (size_t)probes);
+	else
+		dirwalk_run(path, &options, filter);
+	watch_free(options.watch);
+
+	int status = 0;
+	if (options.cache) {
+		status = cache_save(options.cache) < 0;
+		cache_close(options.cache);
+	}
+	pred_free(pred);
+	du_free(options.du);
+	dupes_free(options.dupes);
+	if (options.visited)
+		inode_set_destroy(options.visited);
 
-	return 0;
+	return status;
 }
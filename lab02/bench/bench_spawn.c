@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#ifdef SYS_clone3
+#include <linux/sched.h>
+#endif
+
+#define ENV_FILENAME    "env.txt"
+#define PROBE_ARG       "--probe"
+#define PROBE_FD        3
+#define PROBE_TIMEOUT   5000
+#define DEFAULT_RUNS    1000
+#define DEFAULT_RSS     "0,64,256"
+#define DEFAULT_ENV     "0,100,1000"
+#define PAD_VALUE_LEN   32
+#define MAX_LEVELS      16
+#define MAX_BASE_VARS   62
+
+typedef pid_t (*SpawnFunc)(const char *path, char *argv[], char **env, int probe_fd);
+
+typedef struct {
+    const char *name;
+    SpawnFunc spawn;
+} Method;
+
+/* fork+execve — как в StartChild() с --fork: копируются таблицы страниц
+ * родителя, и цена растёт с его RSS. */
+static pid_t SpawnFork(const char *path, char *argv[], char **env, int probe_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (dup2(probe_fd, PROBE_FD) < 0)
+            _exit(127);
+        execve(path, argv, env);
+        _exit(127);
+    }
+    return pid;
+}
+
+/* vfork: адресное пространство общее, родитель стоит до execve. */
+static pid_t SpawnVfork(const char *path, char *argv[], char **env, int probe_fd) {
+    pid_t pid = vfork();
+    if (pid == 0) {
+        if (dup2(probe_fd, PROBE_FD) < 0)
+            _exit(127);
+        execve(path, argv, env);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t SpawnPosix(const char *path, char *argv[], char **env, int probe_fd) {
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+    posix_spawn_file_actions_adddup2(&actions, probe_fd, PROBE_FD);
+    int err = posix_spawn(&pid, path, &actions, NULL, argv, env);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+#ifdef SYS_clone3
+
+/* clone3 без CLONE_VM (с CLONE_VM нужен отдельный стек и ассемблерная
+ * обвязка; этот вариант и так измеряется через posix_spawn, который в
+ * glibc ≥ 2.34 сам вызывает clone3(CLONE_VM | CLONE_VFORK)). PIDFD
+ * приходит сразу из вызова, без отдельного pidfd_open. */
+static pid_t SpawnClone3(const char *path, char *argv[], char **env, int probe_fd) {
+    int pidfd = -1;
+    struct clone_args args = {
+        .flags = CLONE_PIDFD,
+        .pidfd = (unsigned long)&pidfd,
+        .exit_signal = SIGCHLD,
+    };
+    long pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0) {
+        if (dup2(probe_fd, PROBE_FD) < 0)
+            _exit(127);
+        execve(path, argv, env);
+        _exit(127);
+    }
+    if (pidfd >= 0)
+        close(pidfd);
+    return (pid_t)pid;
+}
+
+#endif
+
+static const Method methods[] = {
+    { "fork+execve", SpawnFork },
+    { "vfork", SpawnVfork },
+    { "posix_spawn", SpawnPosix },
+#ifdef SYS_clone3
+    { "clone3", SpawnClone3 },
+#endif
+};
+
+static double ElapsedUs(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+static int LatencyCmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Ближайший ранг: при 1000 запусках p999 — самый медленный из них. */
+static double Percentile(const double *sorted, int count, double p) {
+    int rank = (int)(p * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/* Окружение в форме вывода CreateChildEnv(): переменные из env.txt и
+ * CHILD_PATH, плюс `extra` искусственных переменных. */
+static char **BuildEnv(int extra, size_t *bytes) {
+    char **env = xmalloc(((size_t)extra + MAX_BASE_VARS + 2) * sizeof(char *));
+    size_t count = 0;
+    *bytes = 0;
+
+    FILE *env_file = fopen(ENV_FILENAME, "r");
+    char line[256];
+    while (env_file && count < MAX_BASE_VARS && fgets(line, sizeof(line), env_file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+        const char *value = getenv(line);
+        if (asprintf(&env[count], "%s=%s", line, value ? value : "") < 0) {
+            perror("asprintf");
+            exit(EXIT_FAILURE);
+        }
+        *bytes += strlen(env[count++]) + 1;
+    }
+    if (env_file)
+        fclose(env_file);
+    if (getenv("CHILD_PATH") && asprintf(&env[count], "CHILD_PATH=%s", getenv("CHILD_PATH")) >= 0)
+        *bytes += strlen(env[count++]) + 1;
+
+    for (int i = 0; i < extra; i++) {
+        if (asprintf(&env[count], "BENCH_PAD_%05d=%0*d", i, PAD_VALUE_LEN, i) < 0) {
+            perror("asprintf");
+            exit(EXIT_FAILURE);
+        }
+        *bytes += strlen(env[count++]) + 1;
+    }
+    env[count] = NULL;
+    return env;
+}
+
+static void FreeEnv(char **env) {
+    for (char **e = env; *e; e++)
+        free(*e);
+    free(env);
+}
+
+/* Один запуск: до первой инструкции — до момента, записанного child в
+ * начале main() (часы CLOCK_MONOTONIC общие для всех процессов), до
+ * завершения — до возврата waitpid(). */
+static int SpawnOnce(const Method *method, const char *self, char **env, int probe[2],
+                     double *start_us, double *exit_us) {
+    char *argv[] = { (char *)"bench_spawn", (char *)PROBE_ARG, NULL };
+    struct timespec t0, child_start, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pid_t pid = method->spawn(self, argv, env, probe[1]);
+    if (pid < 0) {
+        perror(method->name);
+        return -1;
+    }
+
+    struct pollfd pfd = { .fd = probe[0], .events = POLLIN };
+    int ready = poll(&pfd, 1, PROBE_TIMEOUT) == 1 &&
+                read(probe[0], &child_start, sizeof(child_start)) == sizeof(child_start);
+    int status;
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (!ready || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: child не запустился\n", method->name);
+        return -1;
+    }
+    *start_us = ElapsedUs(&t0, &child_start);
+    *exit_us = ElapsedUs(&t0, &t1);
+    return 0;
+}
+
+static int ParseList(const char *text, int values[]) {
+    int count = 0;
+    char *copy = strdup(text);
+    for (char *save = NULL, *item = strtok_r(copy, ",", &save); item && count < MAX_LEVELS;
+         item = strtok_r(NULL, ",", &save)) {
+        values[count] = atoi(item);
+        if (values[count++] < 0)
+            break;
+    }
+    free(copy);
+    return count > 0 && values[count - 1] < 0 ? -1 : count;
+}
+
+static void Usage(const char *prog) {
+    fprintf(stderr, "Использование: %s [-n запусков] [-m RSS_МБ,...] [-e доп_переменных,...]\n"
+            "  по умолчанию -n %d -m %s -e %s\n", prog, DEFAULT_RUNS, DEFAULT_RSS, DEFAULT_ENV);
+    exit(EXIT_FAILURE);
+}
+
+/* Строка CSV на каждое сочетание способа запуска, RSS родителя и размера
+ * окружения; задержки в микросекундах. Целевой процесс — сам бенчмарк с
+ * PROBE_ARG: он только пишет время старта и выходит. */
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], PROBE_ARG) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        _exit(write(PROBE_FD, &now, sizeof(now)) == sizeof(now) ? 0 : 1);
+    }
+
+    int runs = DEFAULT_RUNS;
+    const char *rss_list = DEFAULT_RSS;
+    const char *env_list = DEFAULT_ENV;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:e:")) != -1) {
+        switch (opt) {
+            case 'n': runs = atoi(optarg); break;
+            case 'm': rss_list = optarg; break;
+            case 'e': env_list = optarg; break;
+            default: Usage(argv[0]);
+        }
+    }
+    int rss_mb[MAX_LEVELS], env_extra[MAX_LEVELS];
+    int rss_count = ParseList(rss_list, rss_mb);
+    int env_count = ParseList(env_list, env_extra);
+    if (runs <= 0 || rss_count <= 0 || env_count <= 0 || optind != argc)
+        Usage(argv[0]);
+
+    char self[4096];
+    ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        perror("/proc/self/exe");
+        return EXIT_FAILURE;
+    }
+    self[self_len] = '\0';
+
+    int probe[2];
+    if (pipe2(probe, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+    double *start_us = xmalloc(runs * sizeof(double));
+    double *exit_us = xmalloc(runs * sizeof(double));
+
+    printf("method,rss_mb,env_vars,env_bytes,runs,"
+           "start_p50_us,start_p99_us,start_p999_us,exit_p50_us,exit_p99_us,exit_p999_us\n");
+    for (int r = 0; r < rss_count; r++) {
+        /* Память именно занята (страницы тронуты), иначе копировать нечего. */
+        size_t ballast_size = (size_t)rss_mb[r] << 20;
+        char *ballast = ballast_size ? xmalloc(ballast_size) : NULL;
+        if (ballast)
+            memset(ballast, 1, ballast_size);
+
+        for (int e = 0; e < env_count; e++) {
+            size_t env_bytes;
+            char **env = BuildEnv(env_extra[e], &env_bytes);
+            int env_vars = 0;
+            while (env[env_vars])
+                env_vars++;
+
+            for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+                const Method *method = &methods[m];
+                int done = 0;
+                while (done < runs &&
+                       SpawnOnce(method, self, env, probe, &start_us[done], &exit_us[done]) == 0)
+                    done++;
+                if (done == 0)
+                    continue;
+
+                qsort(start_us, done, sizeof(double), LatencyCmp);
+                qsort(exit_us, done, sizeof(double), LatencyCmp);
+                printf("%s,%d,%d,%zu,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", method->name, rss_mb[r],
+                       env_vars, env_bytes, done,
+                       Percentile(start_us, done, 0.50), Percentile(start_us, done, 0.99),
+                       Percentile(start_us, done, 0.999), Percentile(exit_us, done, 0.50),
+                       Percentile(exit_us, done, 0.99), Percentile(exit_us, done, 0.999));
+                fflush(stdout);
+            }
+            FreeEnv(env);
+        }
+        free(ballast);
+    }
+
+    free(start_us);
+    free(exit_us);
+    close(probe[0]);
+    close(probe[1]);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+#define CAPTURE_LABEL_SIZE 32
+
+/* Имя потока хранится сразу за структурой. */
+static const char *StreamLabel(const CaptureStream *stream) {
+    return (const char *)(stream + 1);
+}
+
+static void PendingReserve(Capture *capture, size_t extra) {
+    if (capture->pending_len + extra <= capture->pending_cap)
+        return;
+    size_t cap = capture->pending_cap ? capture->pending_cap : 4096;
+    while (cap < capture->pending_len + extra)
+        cap *= 2;
+    char *data = realloc(capture->pending, cap);
+    if (!data) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    capture->pending = data;
+    capture->pending_cap = cap;
+}
+
+static void PendingAppend(Capture *capture, const char *data, size_t len) {
+    PendingReserve(capture, len);
+    memcpy(capture->pending + capture->pending_len, data, len);
+    capture->pending_len += len;
+}
+
+static void OutputWatch(Capture *capture, int on) {
+    if (capture->out_waiting == on)
+        return;
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = capture };
+    if (epoll_ctl(capture->epfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, capture->out_fd, &ev) == 0)
+        capture->out_waiting = on;
+}
+
+/* Пишет накопленное, пока терминал принимает; остаток ждёт EPOLLOUT. */
+static void OutputFlush(Capture *capture) {
+    while (capture->pending_off < capture->pending_len) {
+        ssize_t n = write(capture->out_fd, capture->pending + capture->pending_off,
+                          capture->pending_len - capture->pending_off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                OutputWatch(capture, 1);
+                return;
+            }
+            perror("write");
+            capture->pending_off = capture->pending_len;
+            break;
+        }
+        capture->pending_off += (size_t)n;
+    }
+    capture->pending_off = 0;
+    capture->pending_len = 0;
+    OutputWatch(capture, 0);
+}
+
+/* Копирует `len` байт кольца начиная с `from` (смещение от головы). */
+static void RingCopy(const CaptureStream *stream, size_t from, size_t len, char *out) {
+    size_t start = (stream->head + from) % CAPTURE_RING_SIZE;
+    size_t first = CAPTURE_RING_SIZE - start < len ? CAPTURE_RING_SIZE - start : len;
+    memcpy(out, stream->ring + start, first);
+    memcpy(out + first, stream->ring, len - first);
+}
+
+static void RingConsume(CaptureStream *stream, size_t len) {
+    stream->head = (stream->head + len) % CAPTURE_RING_SIZE;
+    stream->len -= len;
+    if (stream->len == 0)
+        stream->head = 0;
+}
+
+static size_t RingLine(const CaptureStream *stream) {
+    for (size_t i = 0; i < stream->len; i++) {
+        if (stream->ring[(stream->head + i) % CAPTURE_RING_SIZE] == '\n')
+            return i + 1;
+    }
+    return 0;
+}
+
+static void FileWrite(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("write");
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+/* Отдаёт целые строки потока; при `final` и для переполненного кольца без
+ * перевода строки — и неполную. Возвращает 0, если места в pending не
+ * хватило и часть строк осталась в кольце. */
+static int StreamLines(Capture *capture, CaptureStream *stream, int final) {
+    char line[CAPTURE_RING_SIZE + CAPTURE_LABEL_SIZE + 64];
+    for (;;) {
+        size_t len = RingLine(stream);
+        int partial = 0;
+        if (len == 0 && stream->len > 0 && (final || stream->len == CAPTURE_RING_SIZE)) {
+            len = stream->len;
+            partial = 1;
+        }
+        if (len == 0)
+            return 1;
+
+        if (stream->file_fd >= 0) {
+            RingCopy(stream, 0, len, line);
+            FileWrite(stream->file_fd, line, len);
+            RingConsume(stream, len);
+            continue;
+        }
+
+        char note[CAPTURE_LABEL_SIZE + 64];
+        int note_len = 0;
+        if (stream->dropped) {
+            note_len = snprintf(note, sizeof(note), "[%s] ... пропущено %zu байт\n",
+                                StreamLabel(stream), stream->dropped);
+        }
+        int prefix = snprintf(line, sizeof(line), "[%s%s] ", StreamLabel(stream),
+                              stream->is_err ? " stderr" : "");
+        size_t total = (size_t)note_len + (size_t)prefix + len + (size_t)partial;
+        if (capture->pending_len + total > CAPTURE_PENDING_MAX)
+            return 0;
+
+        if (note_len > 0)
+            PendingAppend(capture, note, (size_t)note_len);
+        stream->dropped = 0;
+        RingCopy(stream, 0, len, line + prefix);
+        if (partial)
+            line[prefix + len] = '\n';
+        PendingAppend(capture, line, (size_t)prefix + len + (size_t)partial);
+        RingConsume(stream, len);
+    }
+}
+
+static void StreamClose(Capture *capture, CaptureStream *stream) {
+    epoll_ctl(capture->epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+    close(stream->fd);
+    stream->fd = -1;
+    capture->open_streams--;
+}
+
+/* Вычитывает канал до EAGAIN. Когда кольцо полно, а строки некуда деть
+ * (терминал отстал), теряется старейшая половина кольца: канал child
+ * всегда остаётся свободным. */
+static void StreamRead(Capture *capture, CaptureStream *stream) {
+    for (;;) {
+        if (stream->len == CAPTURE_RING_SIZE && !StreamLines(capture, stream, 0)) {
+            stream->dropped += CAPTURE_RING_SIZE / 2;
+            RingConsume(stream, CAPTURE_RING_SIZE / 2);
+        }
+        size_t tail = (stream->head + stream->len) % CAPTURE_RING_SIZE;
+        size_t room = CAPTURE_RING_SIZE - stream->len;
+        if (room > CAPTURE_RING_SIZE - tail)
+            room = CAPTURE_RING_SIZE - tail;
+
+        ssize_t n = read(stream->fd, stream->ring + tail, room);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN) {
+                perror("read");
+                StreamClose(capture, stream);
+            }
+            break;
+        }
+        if (n == 0) {
+            StreamClose(capture, stream);
+            break;
+        }
+        stream->len += (size_t)n;
+    }
+    StreamLines(capture, stream, stream->fd < 0);
+}
+
+static CaptureStream *StreamFind(Capture *capture, const char *label, const CaptureStream *skip) {
+    for (CaptureStream *stream = capture->streams; stream; stream = stream->next) {
+        if (stream != skip && strcmp(StreamLabel(stream), label) == 0)
+            return stream;
+    }
+    return NULL;
+}
+
+static void StreamFree(CaptureStream *stream) {
+    if (stream->fd >= 0)
+        close(stream->fd);
+    if (stream->file_fd >= 0)
+        close(stream->file_fd);
+    free(stream->trailer);
+    free(stream->ring);
+    free(stream);
+}
+
+/* Раздаёт освободившееся место в pending потокам, освобождает отработавшие.
+ * Текст, отложенный до конца вывода child, переходит к его второму потоку,
+ * а если тот уже выведен — встаёт в pending. */
+static void StreamsDrain(Capture *capture) {
+    for (CaptureStream **link = &capture->streams; *link;) {
+        CaptureStream *stream = *link;
+        int done = StreamLines(capture, stream, stream->fd < 0);
+        if (done && stream->fd < 0 && stream->len == 0 && !stream->dropped) {
+            *link = stream->next;
+            if (stream->trailer) {
+                CaptureStream *other = StreamFind(capture, StreamLabel(stream), stream);
+                if (other && !other->trailer) {
+                    other->trailer = stream->trailer;
+                    other->trailer_len = stream->trailer_len;
+                    stream->trailer = NULL;
+                } else {
+                    PendingAppend(capture, stream->trailer, stream->trailer_len);
+                }
+            }
+            StreamFree(stream);
+            continue;
+        }
+        link = &stream->next;
+    }
+    OutputFlush(capture);
+}
+
+/* Для терминала и канала открывается отдельное файловое описание с
+ * O_NONBLOCK, чтобы не менять режим stdout, общего с оболочкой. Обычный
+ * файл не блокирует и пишется через dup(). */
+int CaptureInit(Capture *capture, int epfd, const char *dir) {
+    memset(capture, 0, sizeof(*capture));
+    capture->kind = EPOLL_KIND_OUTPUT;
+    capture->epfd = epfd;
+    capture->dir = dir;
+    fflush(stdout);
+
+    struct stat st;
+    capture->out_fd = -1;
+    if (fstat(STDOUT_FILENO, &st) == 0 && !S_ISREG(st.st_mode))
+        capture->out_fd = open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (capture->out_fd < 0)
+        capture->out_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (capture->out_fd < 0) {
+        perror("stdout");
+        return -1;
+    }
+    return 0;
+}
+
+static CaptureStream *StreamNew(Capture *capture, const char *label, int fd, int is_err) {
+    CaptureStream *stream = calloc(1, sizeof(CaptureStream) + CAPTURE_LABEL_SIZE);
+    if (!stream || !(stream->ring = malloc(CAPTURE_RING_SIZE))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    stream->kind = EPOLL_KIND_STREAM;
+    stream->fd = fd;
+    stream->is_err = is_err;
+    stream->file_fd = -1;
+    snprintf((char *)(stream + 1), CAPTURE_LABEL_SIZE, "%s", label);
+
+    if (capture->dir) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s.%s", capture->dir, label, is_err ? "err" : "out");
+        stream->file_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (stream->file_fd < 0)
+            perror(path);
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = stream };
+    if (epoll_ctl(capture->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+    stream->next = capture->streams;
+    capture->streams = stream;
+    capture->open_streams++;
+    return stream;
+}
+
+/* Создаёт каналы для stdout и stderr нового child. child_fds получает их
+ * пишущие концы (с O_CLOEXEC: их нужно dup2() в child и закрыть в родителе
+ * после запуска). */
+int CaptureChild(Capture *capture, const char *label, int child_fds[2]) {
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) < 0)
+        return -1;
+    if (pipe2(err, O_CLOEXEC) < 0) {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    fcntl(err[0], F_SETFL, O_NONBLOCK);
+    StreamNew(capture, label, out[0], 0);
+    StreamNew(capture, label, err[0], 1);
+    child_fds[0] = out[1];
+    child_fds[1] = err[1];
+    return 0;
+}
+
+/* Строка самого родителя: встаёт в очередь после уже принятых строк child. */
+void CaptureText(Capture *capture, const char *text, size_t len) {
+    PendingAppend(capture, text, len);
+    if (!capture->out_waiting)
+        OutputFlush(capture);
+}
+
+/* Как CaptureText(), но после всего вывода child с этим именем: строка
+ * не обгоняет даже то, что ещё лежит в его каналах и кольцах. */
+void CaptureTextAfter(Capture *capture, const char *label, const char *text, size_t len) {
+    CaptureStream *stream = StreamFind(capture, label, NULL);
+    if (!stream || stream->trailer) {
+        CaptureText(capture, text, len);
+        return;
+    }
+    if (!(stream->trailer = malloc(len))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(stream->trailer, text, len);
+    stream->trailer_len = len;
+    StreamsDrain(capture);
+}
+
+/* Убирает потоки child, который так и не запустился, вместе с их пустыми
+ * файлами. Пишущие концы каналов к этому моменту уже закрыты. */
+void CaptureDiscard(Capture *capture, const char *label) {
+    for (CaptureStream **link = &capture->streams; *link;) {
+        CaptureStream *stream = *link;
+        if (strcmp(StreamLabel(stream), label) != 0) {
+            link = &stream->next;
+            continue;
+        }
+        *link = stream->next;
+        if (stream->fd >= 0) {
+            epoll_ctl(capture->epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+            capture->open_streams--;
+        }
+        if (capture->dir) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s.%s", capture->dir, label, stream->is_err ? "err" : "out");
+            unlink(path);
+        }
+        StreamFree(stream);
+    }
+}
+
+/* epoll_wait на общем epoll: события каналов и терминала обрабатываются
+ * здесь, остальные возвращаются вызывающему в начале `events`. */
+int CapturePoll(Capture *capture, struct epoll_event *events, int max, int timeout) {
+    for (;;) {
+        int n = epoll_wait(capture->epfd, events, max, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return -1;
+        }
+        int foreign = 0;
+        int drain = 0;
+        for (int i = 0; i < n; i++) {
+            int kind = *(int *)events[i].data.ptr;
+            if (kind == EPOLL_KIND_STREAM) {
+                StreamRead(capture, events[i].data.ptr);
+                drain = 1;
+            } else if (kind == EPOLL_KIND_OUTPUT) {
+                OutputFlush(capture);
+                drain = 1;
+            } else {
+                events[foreign++] = events[i];
+            }
+        }
+        if (drain)
+            StreamsDrain(capture);
+        if (foreign > 0 || n == 0 || timeout >= 0)
+            return foreign;
+    }
+}
+
+/* Дочитывает все каналы до EOF и выводит остаток. Чужих fd в epoll к
+ * этому моменту быть не должно. */
+void CaptureFinish(Capture *capture) {
+    struct epoll_event events[16];
+    StreamsDrain(capture);
+    while (capture->open_streams > 0 || capture->streams || capture->pending_len > 0) {
+        if (CapturePoll(capture, events, 16, 100) < 0)
+            break;
+        StreamsDrain(capture);
+    }
+}
+
+void CaptureFree(Capture *capture) {
+    while (capture->streams) {
+        CaptureStream *stream = capture->streams;
+        capture->streams = stream->next;
+        StreamFree(stream);
+    }
+    OutputWatch(capture, 0);
+    close(capture->out_fd);
+    free(capture->pending);
+}
@@ -0,0 +1,64 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define CAPTURE_RING_SIZE    (64 * 1024)
+#define CAPTURE_PENDING_MAX  (1024 * 1024)
+
+/* Первое поле у всего, что лежит в epoll родителя: по нему CapturePoll()
+ * отличает свои события от чужих (pidfd заданий, stdin). */
+enum {
+    EPOLL_KIND_STREAM = 1,
+    EPOLL_KIND_OUTPUT,
+    EPOLL_KIND_JOB,
+    EPOLL_KIND_INPUT
+};
+
+/* stdout или stderr одного child. Канал читается сразу, как только в нём
+ * есть данные, в кольцевой буфер; наружу уходят только целые строки. */
+typedef struct CaptureStream {
+    int kind;
+    int fd;
+    int is_err;
+    char *ring;
+    size_t head;
+    size_t len;
+    size_t dropped;
+    int file_fd;
+    char *trailer;
+    size_t trailer_len;
+    struct CaptureStream *next;
+} CaptureStream;
+
+/* Строки всех child копятся в pending и пишутся в терминал без
+ * блокировки. Если терминал не успевает, pending растёт до
+ * CAPTURE_PENDING_MAX, затем кольца переполняются и теряют старые данные
+ * (с пометкой о числе пропущенных байт), но child никогда не ждёт. С
+ * каталогом для файлов вывод каждого потока пишется в свой файл. */
+typedef struct {
+    int kind;
+    int epfd;
+    int out_fd;
+    int out_waiting;
+    char *pending;
+    size_t pending_len;
+    size_t pending_off;
+    size_t pending_cap;
+    const char *dir;
+    CaptureStream *streams;
+    int open_streams;
+} Capture;
+
+int  CaptureInit(Capture *capture, int epfd, const char *dir);
+int  CaptureChild(Capture *capture, const char *label, int child_fds[2]);
+void CaptureText(Capture *capture, const char *text, size_t len);
+void CaptureTextAfter(Capture *capture, const char *label, const char *text, size_t len);
+void CaptureDiscard(Capture *capture, const char *label);
+int  CapturePoll(Capture *capture, struct epoll_event *events, int max, int timeout);
+void CaptureFinish(Capture *capture);
+void CaptureFree(Capture *capture);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef CHILD_RUN_H
+#define CHILD_RUN_H
+
+/* Тело child: вызывается из main() child и из процессов zygote родителя,
+ * которые запускают child без execve. */
+int RunChild(int argc, char *argv[], char *envp[]);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "envSnapshot.h"
+
+#define ENV_BLOCK_SIZE (64 * 1024)
+#define ENV_MIN_SLOTS  64
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+static uint32_t NameHash(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t NameLen(const char *entry) {
+    const char *eq = strchr(entry, '=');
+    return eq ? (size_t)(eq - entry) : strlen(entry);
+}
+
+static char *ArenaAlloc(EnvSnapshot *env, size_t size) {
+    EnvBlock *block = env->blocks;
+    if (!block || block->cap - block->used < size) {
+        size_t cap = size > ENV_BLOCK_SIZE ? size : ENV_BLOCK_SIZE;
+        block = malloc(sizeof(EnvBlock) + cap);
+        if (!block) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        block->used = 0;
+        block->cap = cap;
+        block->next = env->blocks;
+        env->blocks = block;
+    }
+    char *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/* Слот с именем или первый пустой слот, куда его можно вставить. */
+static uint32_t *FindSlot(const EnvSnapshot *env, const char *name, size_t len, uint32_t hash) {
+    for (size_t i = hash & env->slot_mask;; i = (i + 1) & env->slot_mask) {
+        uint32_t *slot = &env->slots[i];
+        if (*slot == 0)
+            return slot;
+        const EnvVar *var = &env->vars[*slot - 1];
+        if (var->hash == hash && var->name_len == len && memcmp(var->entry, name, len) == 0)
+            return slot;
+    }
+}
+
+static void Rehash(EnvSnapshot *env, size_t slots) {
+    free(env->slots);
+    env->slots = calloc(slots, sizeof(uint32_t));
+    if (!env->slots) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    env->slot_mask = slots - 1;
+    for (size_t i = 0; i < env->count; i++) {
+        const EnvVar *var = &env->vars[i];
+        *FindSlot(env, var->entry, var->name_len, var->hash) = (uint32_t)(i + 1);
+    }
+}
+
+void EnvInit(EnvSnapshot *env) {
+    memset(env, 0, sizeof(*env));
+    env->vector = xrealloc(NULL, sizeof(char *));
+    env->vector[0] = NULL;
+    Rehash(env, ENV_MIN_SLOTS);
+}
+
+/* Копирует environ целиком: последующие setenv() снимок не меняют. */
+void EnvCapture(EnvSnapshot *env, char **envp) {
+    for (char **e = envp; *e; e++)
+        EnvAdd(env, *e, 1);
+}
+
+/* Добавляет "ИМЯ=значение"; переменная с тем же именем заменяется на
+ * месте. Без copy строка не копируется и должна жить не меньше снимка. */
+void EnvAdd(EnvSnapshot *env, const char *entry, int copy) {
+    size_t len = NameLen(entry);
+    uint32_t hash = NameHash(entry, len);
+    if (copy) {
+        size_t size = strlen(entry) + 1;
+        entry = memcpy(ArenaAlloc(env, size), entry, size);
+    }
+
+    uint32_t *slot = FindSlot(env, entry, len, hash);
+    if (*slot != 0) {
+        env->vars[*slot - 1].entry = entry;
+        env->vector[*slot - 1] = (char *)entry;
+    } else {
+        if (env->count + 1 >= env->cap) {
+            env->cap = env->cap ? env->cap * 2 : 64;
+            env->vars = xrealloc(env->vars, env->cap * sizeof(EnvVar));
+            env->vector = xrealloc(env->vector, (env->cap + 1) * sizeof(char *));
+        }
+        env->vars[env->count] = (EnvVar){ .entry = entry, .name_len = len, .hash = hash };
+        env->vector[env->count] = (char *)entry;
+        *slot = (uint32_t)++env->count;
+        env->vector[env->count] = NULL;
+        if (env->count * 2 > env->slot_mask + 1)
+            Rehash(env, (env->slot_mask + 1) * 2);
+    }
+    env->vector_len = env->count;
+    free(env->sorted);
+    env->sorted = NULL;
+}
+
+void EnvSet(EnvSnapshot *env, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    char *entry = ArenaAlloc(env, name_len + value_len + 2);
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(entry + name_len + 1, value, value_len + 1);
+    EnvAdd(env, entry, 0);
+}
+
+/* Вся строка "ИМЯ=значение" по имени или NULL. */
+const char *EnvEntry(const EnvSnapshot *env, const char *name, size_t name_len) {
+    uint32_t slot = *FindSlot(env, name, name_len, NameHash(name, name_len));
+    return slot ? env->vars[slot - 1].entry : NULL;
+}
+
+const char *EnvGet(const EnvSnapshot *env, const char *name) {
+    size_t len = strlen(name);
+    const char *entry = EnvEntry(env, name, len);
+    return entry ? entry + len + 1 : NULL;
+}
+
+static int EntryCmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Отсортированный по strcmp NULL-терминированный массив строк снимка. */
+char **EnvSorted(EnvSnapshot *env) {
+    if (!env->sorted) {
+        env->sorted = xrealloc(NULL, (env->count + 1) * sizeof(char *));
+        memcpy(env->sorted, env->vector, (env->count + 1) * sizeof(char *));
+        qsort(env->sorted, env->count, sizeof(char *), EntryCmp);
+    }
+    return env->sorted;
+}
+
+/* Накладывает delta ("ИМЯ=значение", строки не копируются) на vector:
+ * существующие имена подменяются через хеш-индекс, новые дописываются в
+ * конец, повтор имени в delta побеждает предыдущий. Снимок и индекс не
+ * меняются; EnvRestore() возвращает vector в прежний вид. */
+char **EnvApply(EnvSnapshot *env, char *const delta[], size_t count) {
+    if (env->undo_count + count > env->undo_cap) {
+        env->undo_cap = env->undo_count + count;
+        env->undo = xrealloc(env->undo, env->undo_cap * sizeof(EnvUndo));
+    }
+    if (env->vector_len + count > env->cap) {
+        env->cap = env->vector_len + count;
+        env->vars = xrealloc(env->vars, env->cap * sizeof(EnvVar));
+        env->vector = xrealloc(env->vector, (env->cap + 1) * sizeof(char *));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        size_t len = NameLen(delta[i]);
+        uint32_t slot = *FindSlot(env, delta[i], len, NameHash(delta[i], len));
+        size_t index = slot ? slot - 1 : SIZE_MAX;
+        for (size_t j = env->count; index == SIZE_MAX && j < env->vector_len; j++) {
+            if (strncmp(env->vector[j], delta[i], len + 1) == 0)
+                index = j;
+        }
+        if (index == SIZE_MAX) {
+            env->vector[env->vector_len++] = delta[i];
+            continue;
+        }
+        env->undo[env->undo_count++] = (EnvUndo){ .index = index, .entry = env->vector[index] };
+        env->vector[index] = delta[i];
+    }
+    env->vector[env->vector_len] = NULL;
+    return env->vector;
+}
+
+void EnvRestore(EnvSnapshot *env) {
+    while (env->undo_count > 0) {
+        const EnvUndo *undo = &env->undo[--env->undo_count];
+        env->vector[undo->index] = undo->entry;
+    }
+    env->vector_len = env->count;
+    env->vector[env->count] = NULL;
+}
+
+void EnvFree(EnvSnapshot *env) {
+    while (env->blocks) {
+        EnvBlock *next = env->blocks->next;
+        free(env->blocks);
+        env->blocks = next;
+    }
+    free(env->vars);
+    free(env->vector);
+    free(env->slots);
+    free(env->sorted);
+    free(env->undo);
+    memset(env, 0, sizeof(*env));
+}
@@ -0,0 +1,57 @@
+#ifndef ENV_SNAPSHOT_H
+#define ENV_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Строки "ИМЯ=значение" лежат в блоках арены, а не в отдельных malloc. */
+typedef struct EnvBlock {
+    struct EnvBlock *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} EnvBlock;
+
+typedef struct {
+    const char *entry;
+    size_t name_len;
+    uint32_t hash;
+} EnvVar;
+
+typedef struct {
+    size_t index;
+    char *entry;
+} EnvUndo;
+
+/* Снимок окружения без ограничения на число переменных: порядок
+ * добавления, хеш-индекс по имени (открытая адресация) и отсортированный
+ * вид, который строится при первом запросе. vector — готовый envp для
+ * execve. Поверх снимка можно наложить изменения одного запуска
+ * (EnvApply) и снять их (EnvRestore) за O(числа изменений). */
+typedef struct {
+    EnvBlock *blocks;
+    EnvVar *vars;
+    char **vector;
+    size_t count;
+    size_t cap;
+    uint32_t *slots;
+    size_t slot_mask;
+    char **sorted;
+    size_t vector_len;
+    EnvUndo *undo;
+    size_t undo_count;
+    size_t undo_cap;
+} EnvSnapshot;
+
+void        EnvInit(EnvSnapshot *env);
+void        EnvCapture(EnvSnapshot *env, char **envp);
+void        EnvAdd(EnvSnapshot *env, const char *entry, int copy);
+void        EnvSet(EnvSnapshot *env, const char *name, const char *value);
+const char *EnvEntry(const EnvSnapshot *env, const char *name, size_t name_len);
+const char *EnvGet(const EnvSnapshot *env, const char *name);
+char      **EnvSorted(EnvSnapshot *env);
+char      **EnvApply(EnvSnapshot *env, char *const delta[], size_t count);
+void        EnvRestore(EnvSnapshot *env);
+void        EnvFree(EnvSnapshot *env);
+
+#endif
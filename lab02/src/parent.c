@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,146 +6,828 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <locale.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <signal.h>
+#include "childRun.h"
+#include "capture.h"
+#include "envSnapshot.h"
 
 extern char **environ;
 
-#define MAX_ENV_VARS 100
 #define CHILD_NAME_FORMAT "child_%02d"
 #define ENV_FILENAME "env.txt"
+#define CHILD_MODES "+*&"
+#define CHILD_MODE_COUNT 3
+#define MAX_JOB_ARGS 64
+#define ZYGOTE_SPARES 4
 
-int EvcCmp(const void *a, const void *b) {
-    const char *s1 = *(const char **)a;
-    const char *s2 = *(const char **)b;
-    return strcmp(s1, s2);
-}
+/* Задание пакетного режима: pidfd становится читаемым, когда процесс
+ * завершился, и epoll будит родителя сразу, без SIGCHLD и опроса. */
+typedef struct {
+    int kind;
+    pid_t pid;
+    int pidfd;
+    int number;
+    char label[16];
+    struct timespec start;
+} Job;
 
-void PrintEnvSorted() {
-    char *env_vars[MAX_ENV_VARS];
-    int count = 0;
-    for (char **env = environ; *env != NULL && count < MAX_ENV_VARS; env++) {
-        env_vars[count++] = *env;
-    }
-    qsort(env_vars, count, sizeof(char *), EvcCmp);
+/* Zygote: шаблонный процесс, порождённый после CreateChildEnv(), держит
+ * ZYGOTE_SPARES заранее созданных копий. Копии ждут запрос на общем
+ * SOCK_SEQPACKET-сокете; получившая запрос отвечает своим PID (это и есть
+ * момент готовности), сообщает шаблону, чтобы тот создал замену, и
+ * выполняет RunChild() без execve и динамической компоновки. */
+typedef struct {
+    pid_t pid;
+    int sock;
+} Zygote;
+
+typedef struct {
+    char mode;
+    int number;
+} ZygoteRequest;
+
+/* Путь к child для каждого режима ищется и проверяется один раз при старте,
+ * а не в каждом порождённом процессе. */
+typedef struct {
+    char mode;
+    char *path;
+} ChildTarget;
+
+void PrintEnvSorted(EnvSnapshot *parent_env) {
     printf("Родительское окружение (отсортированное):\n");
-    for (int i = 0; i < count; i++) {
-        puts(env_vars[i]);
+    for (char **env = EnvSorted(parent_env); *env != NULL; env++) {
+        puts(*env);
     }
     printf("\n");
 }
 
-char **CreateChildEnv() {
+/* Строки child, которые есть у родителя, не копируются: снимок child
+ * ссылается на строки снимка родителя. */
+void CreateChildEnv(EnvSnapshot *parent_env, EnvSnapshot *child_env) {
     FILE *env_file = fopen(ENV_FILENAME, "r");
     if (!env_file) {
         perror("Ошибка открытия файла env.txt");
         exit(EXIT_FAILURE);
     }
 
-    char *env_entries[MAX_ENV_VARS];
-    int count = 0;
-    char line[256];
-
-    while (fgets(line, sizeof(line), env_file) != NULL && count < MAX_ENV_VARS) {
+    EnvInit(child_env);
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, env_file) > 0) {
         line[strcspn(line, "\r\n")] = '\0';
         if (line[0] == '\0') continue;
 
-        char *value = getenv(line);
-        if (!value) value = "";
-
-        size_t len = strlen(line) + strlen(value) + 2;
-        env_entries[count] = malloc(len);
-        if (!env_entries[count]) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
-        snprintf(env_entries[count], len, "%s=%s", line, value);
-        count++;
+        const char *entry = EnvEntry(parent_env, line, strlen(line));
+        if (entry)
+            EnvAdd(child_env, entry, 0);
+        else
+            EnvSet(child_env, line, "");
     }
+    free(line);
     fclose(env_file);
 
-    if (getenv("CHILD_PATH")) {
-        size_t len = strlen("CHILD_PATH=") + strlen(getenv("CHILD_PATH")) + 1;
-        env_entries[count] = malloc(len);
-        snprintf(env_entries[count], len, "CHILD_PATH=%s", getenv("CHILD_PATH"));
-        count++;
+    const char *child_path = EnvEntry(parent_env, "CHILD_PATH", strlen("CHILD_PATH"));
+    if (child_path)
+        EnvAdd(child_env, child_path, 0);
+}
+
+char *FindChildPath(const char mode, const EnvSnapshot *child_env, const EnvSnapshot *parent_env) {
+    const char *child_path = NULL;
+
+    if (mode == '+') {
+        child_path = getenv("CHILD_PATH");
+        printf("Режим '+': Получаем CHILD_PATH через getenv() -> %s\n", child_path ? child_path : "не найден");
+    } else if (mode == '*') {
+        child_path = EnvGet(child_env, "CHILD_PATH");
+        if (child_path)
+            printf("Режим '*': Найден CHILD_PATH в envp -> %s\n", child_path);
+    } else if (mode == '&') {
+        child_path = EnvGet(parent_env, "CHILD_PATH");
+        if (child_path)
+            printf("Режим '&': Найден CHILD_PATH в глобальном окружении -> %s\n", child_path);
     }
 
-    env_entries[count] = NULL;
-    char **child_env = malloc((count + 1) * sizeof(char *));
-    if (!child_env) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+    return (char *)child_path;
+}
+
+void ResolveChildTargets(ChildTarget targets[], const EnvSnapshot *child_env, const EnvSnapshot *parent_env) {
+    for (int i = 0; i < CHILD_MODE_COUNT; i++) {
+        targets[i].mode = CHILD_MODES[i];
+        targets[i].path = FindChildPath(CHILD_MODES[i], child_env, parent_env);
+        if (targets[i].path && access(targets[i].path, X_OK) == -1) {
+            perror(targets[i].path);
+            targets[i].path = NULL;
+        }
+    }
+    printf("\n");
+}
+
+const char *ChildTargetPath(const ChildTarget targets[], char mode) {
+    const char *pos = strchr(CHILD_MODES, mode);
+    return pos ? targets[pos - CHILD_MODES].path : NULL;
+}
+
+int SpawnActions(posix_spawn_file_actions_t *actions, const int *std_fds) {
+    if (posix_spawn_file_actions_init(actions) != 0 ||
+        posix_spawn_file_actions_adddup2(actions, std_fds[0], STDOUT_FILENO) != 0 ||
+        posix_spawn_file_actions_adddup2(actions, std_fds[1], STDERR_FILENO) != 0) {
+        fprintf(stderr, "posix_spawn_file_actions: ошибка\n");
+        return -1;
     }
-    for (int i = 0; i < count; i++) {
-        child_env[i] = env_entries[i];
+    return 0;
+}
+
+/* posix_spawn в glibc создаёт процесс через clone(CLONE_VM | CLONE_VFORK):
+ * таблицы страниц родителя не копируются, и цена запуска не растёт с его
+ * размером. fork() оставлен для сравнения. std_fds, если задан, становится
+ * stdout и stderr процесса. */
+pid_t LaunchChild(const char *path, char *argv_child[], char **child_env, int use_fork, const int *std_fds) {
+    pid_t pid;
+    if (use_fork) {
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+        } else if (pid == 0) {
+            if (std_fds && (dup2(std_fds[0], STDOUT_FILENO) < 0 || dup2(std_fds[1], STDERR_FILENO) < 0))
+                _exit(EXIT_FAILURE);
+            execve(path, argv_child, child_env);
+            perror("execve");
+            _exit(EXIT_FAILURE);
+        }
+        return pid;
     }
-    child_env[count] = NULL;
 
-    return child_env;
+    posix_spawn_file_actions_t actions;
+    if (std_fds && SpawnActions(&actions, std_fds) < 0)
+        return -1;
+    int err = posix_spawn(&pid, path, std_fds ? &actions : NULL, NULL, argv_child, child_env);
+    if (std_fds)
+        posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+        return -1;
+    }
+    return pid;
 }
 
-char *FindChildPath(const char mode, char **child_env) {
-    char *child_path = NULL;
+/* stdout и stderr для child (при --capture) приходят вместе с запросом
+ * как SCM_RIGHTS. */
+void ZygoteSpare(int sock, int notify, char **child_env) {
+    ZygoteRequest req;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n != sizeof(req))
+        _exit(EXIT_SUCCESS);
+    prctl(PR_SET_PDEATHSIG, 0);
+    /* Копия отвечает всегда, иначе родитель навсегда застрянет в recv():
+     * PID при успехе, -1 если не удалось подключить переданные каналы. */
+    pid_t self = getpid();
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+        int std_fds[2];
+        memcpy(std_fds, CMSG_DATA(cmsg), sizeof(std_fds));
+        if (dup2(std_fds[0], STDOUT_FILENO) < 0 || dup2(std_fds[1], STDERR_FILENO) < 0)
+            self = -1;
+        close(std_fds[0]);
+        close(std_fds[1]);
+    }
+    if (write(notify, "", 1) < 0 || send(sock, &self, sizeof(self), 0) < 0 || self < 0)
+        _exit(EXIT_FAILURE);
+    close(notify);
+    close(sock);
 
-    if (mode == '+') {
-        child_path = getenv("CHILD_PATH");
-        printf("Режим '+': Получаем CHILD_PATH через getenv() -> %s\n", child_path ? child_path : "не найден");
-    } else if (mode == '*') {
-        for (int i = 0; child_env[i] != NULL; i++) {
-            if (strncmp(child_env[i], "CHILD_PATH=", 11) == 0) {
-                child_path = child_env[i] + 11;
-                printf("Режим '*': Найден CHILD_PATH в envp -> %s\n", child_path);
-                break;
+    char child_name[16];
+    snprintf(child_name, sizeof(child_name), CHILD_NAME_FORMAT, req.number);
+    char *argv_child[3] = { child_name, req.mode == '+' ? "env" : NULL, NULL };
+    environ = child_env;
+    exit(RunChild(req.mode == '+' ? 2 : 1, argv_child, child_env));
+}
+
+void ZygoteTemplate(int sock, char **child_env) {
+    int notify[2];
+    if (pipe(notify) < 0) {
+        perror("pipe");
+        _exit(EXIT_FAILURE);
+    }
+    /* Копии не дети родителя: их снимает ядро. */
+    signal(SIGCHLD, SIG_IGN);
+    pid_t self = getpid();
+    for (int spares = 0;;) {
+        while (spares < ZYGOTE_SPARES) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(notify[0]);
+                /* Ждущая копия умирает вместе с шаблоном: иначе она держала
+                 * бы сокет, и родитель не узнал бы, что шаблона больше нет. */
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                if (getppid() != self)
+                    _exit(EXIT_SUCCESS);
+                ZygoteSpare(sock, notify[1], child_env);
             }
-        }
-    } else if (mode == '&') {
-        for (int i = 0; environ[i] != NULL; i++) {
-            if (strncmp(environ[i], "CHILD_PATH=", 11) == 0) {
-                child_path = environ[i] + 11;
-                printf("Режим '&': Найден CHILD_PATH в глобальном окружении -> %s\n", child_path);
+            if (pid < 0) {
+                perror("fork");
                 break;
             }
+            spares++;
         }
+        /* POLLHUP на сокете: родитель закрыл свой конец и больше ничего не
+         * попросит; ожидающие копии получат 0 из recv() и выйдут сами. */
+        struct pollfd fds[2] = { { .fd = notify[0], .events = POLLIN }, { .fd = sock, .events = 0 } };
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (fds[1].revents & (POLLHUP | POLLERR))
+            break;
+        char used[ZYGOTE_SPARES];
+        ssize_t n = fds[0].revents & POLLIN ? read(notify[0], used, sizeof(used)) : 0;
+        if (n > 0)
+            spares -= (int)n;
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+int StartZygote(Zygote *zygote, char **child_env) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        ZygoteTemplate(fds[1], child_env);
+    }
+    close(fds[1]);
+    zygote->pid = pid;
+    zygote->sock = fds[0];
+    return 0;
+}
+
+/* Возвращает PID child, когда тот уже готов выполнять RunChild(). */
+pid_t ZygoteLaunch(Zygote *zygote, char mode, int number, const int *std_fds) {
+    ZygoteRequest req = { .mode = mode, .number = number };
+    pid_t pid;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (std_fds) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), std_fds, 2 * sizeof(int));
+    }
+    fflush(stdout);
+    if (sendmsg(zygote->sock, &msg, MSG_NOSIGNAL) != sizeof(req) ||
+        recv(zygote->sock, &pid, sizeof(pid), 0) != sizeof(pid)) {
+        /* Шаблон больше не отвечает: сокет закрывается, и дальше child
+         * запускаются без него. */
+        perror("zygote");
+        fprintf(stderr, "zygote: шаблон недоступен, запуск без него\n");
+        close(zygote->sock);
+        zygote->sock = -1;
+        return -1;
+    }
+    if (pid < 0)
+        fprintf(stderr, "zygote: копия не смогла подключить каналы вывода\n");
+    return pid;
+}
+
+void StopZygote(Zygote *zygote) {
+    if (zygote->sock >= 0)
+        close(zygote->sock);
+    waitpid(zygote->pid, NULL, 0);
+}
+
+/* Каналы вывода child закрываются в родителе сразу после запуска: EOF на
+ * них означает, что child (и все, кому он их передал) завершился. */
+int CaptureOpen(Capture *capture, const char *label, int std_fds[2]) {
+    if (!capture)
+        return 0;
+    if (CaptureChild(capture, label, std_fds) < 0) {
+        perror("pipe");
+        return -1;
     }
+    return 1;
+}
 
-    return child_path;
+void CaptureClose(int std_fds[2]) {
+    close(std_fds[0]);
+    close(std_fds[1]);
 }
 
-void StartChild(char **child_env, char mode) {
+void StartChild(char **child_env, char mode, const ChildTarget targets[], int use_fork, Zygote *zygote,
+                Capture *capture) {
     static int child_count = 0;
     char child_name[16];
-    snprintf(child_name, sizeof(child_name), CHILD_NAME_FORMAT, child_count++);
+    snprintf(child_name, sizeof(child_name), CHILD_NAME_FORMAT, child_count);
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork");
+    const char *child_prog_path = ChildTargetPath(targets, mode);
+    if (zygote && zygote->sock < 0)
+        zygote = NULL;
+    if (!zygote && !child_prog_path) {
+        fprintf(stderr, "Ошибка: CHILD_PATH не найден\n");
+        child_count++;
         return;
-    } else if (pid == 0) {
-        char *child_prog_path = FindChildPath(mode, child_env);
-        if (!child_prog_path) {
-            fprintf(stderr, "Ошибка: CHILD_PATH не найден\n");
-            exit(EXIT_FAILURE);
+    }
+    int std_fds[2];
+    int captured = CaptureOpen(capture, child_name, std_fds);
+    if (captured < 0)
+        return;
+    /* Если zygote не справился, тот же child запускается обычным путём. */
+    if (zygote && (ZygoteLaunch(zygote, mode, child_count, captured ? std_fds : NULL) > 0 ||
+                   !child_prog_path)) {
+        child_count++;
+        if (captured)
+            CaptureClose(std_fds);
+        return;
+    }
+    child_count++;
+
+    char *argv_child[3];
+    argv_child[0] = child_name;
+    if (mode == '+')
+        argv_child[1] = "env";
+    else
+        argv_child[1] = NULL;
+    argv_child[2] = NULL;
+
+    fflush(stdout);
+    pid_t pid = LaunchChild(child_prog_path, argv_child, child_env, use_fork, captured ? std_fds : NULL);
+    if (captured) {
+        CaptureClose(std_fds);
+        if (pid < 0)
+            CaptureDiscard(capture, child_name);
+    }
+}
+
+/* Снимает завершившихся child, не блокируясь: без этого каждый запуск
+ * оставлял зомби до выхода родителя. */
+void ReapChildren(void) {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+}
+
+double ElapsedMs(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+double TimevalMs(const struct timeval *tv) {
+    return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+/* Строка задания: '+', '*' или '&' запускает child в этом режиме, иначе это
+ * команда с аргументами через пробел (ищется в PATH). Слова ИМЯ=значение
+ * перед ней, как в shell, добавляются к окружению только этого задания.
+ * 1 — задание, 0 — пустая строка или комментарий, -1 — нет пути к child,
+ * -2 — больше MAX_JOB_ARGS слов ИМЯ=значение или слов команды. */
+int ParseJob(char *line, char *argv_job[], char *delta[], int *delta_count, const ChildTarget targets[],
+             char *child_name, size_t name_size, int number, const char **path) {
+    line[strcspn(line, "\r\n")] = '\0';
+    int argc_job = 0;
+    *delta_count = 0;
+    for (char *save = NULL, *word = strtok_r(line, " \t", &save);
+         word; word = strtok_r(NULL, " \t", &save)) {
+        if (argc_job == 0 && word[0] != '=' && word[0] != '#' && strchr(word, '=')) {
+            if (*delta_count == MAX_JOB_ARGS)
+                return -2;
+            delta[(*delta_count)++] = word;
+        } else {
+            if (argc_job == MAX_JOB_ARGS)
+                return argv_job[0][0] == '#' ? 0 : -2;
+            argv_job[argc_job++] = word;
         }
-        if (access(child_prog_path, X_OK) == -1) {
-            perror("access");
-            exit(EXIT_FAILURE);
+    }
+    argv_job[argc_job] = NULL;
+    if (argc_job == 0 || argv_job[0][0] == '#')
+        return 0;
+
+    char mode = argv_job[0][0];
+    if (argv_job[0][1] == '\0' && strchr(CHILD_MODES, mode)) {
+        *path = ChildTargetPath(targets, mode);
+        snprintf(child_name, name_size, CHILD_NAME_FORMAT, number);
+        argv_job[0] = child_name;
+        argv_job[1] = mode == '+' ? "env" : NULL;
+        argv_job[2] = NULL;
+        return *path ? 1 : -1;
+    }
+    *path = NULL;
+    return 1;
+}
+
+pid_t LaunchJob(const char *path, char *argv_job[], char **child_env, int use_fork, const int *std_fds) {
+    if (path)
+        return LaunchChild(path, argv_job, child_env, use_fork, std_fds);
+    pid_t pid;
+    posix_spawn_file_actions_t actions;
+    if (std_fds && SpawnActions(&actions, std_fds) < 0)
+        return -1;
+    int err = posix_spawnp(&pid, argv_job[0], std_fds ? &actions : NULL, NULL, argv_job, child_env);
+    if (std_fds)
+        posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", argv_job[0], strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+/* При перехвате отчёт встаёт в очередь за последней строкой задания: он
+ * выводится, когда оба его канала дочитаны до EOF и выведены. */
+void ReportJob(Job *job, int status, const struct rusage *ru, Capture *output) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    char report[256];
+    int len;
+    if (WIFEXITED(status))
+        len = snprintf(report, sizeof(report), "[%d] pid %d: код %d", job->number, job->pid, WEXITSTATUS(status));
+    else
+        len = snprintf(report, sizeof(report), "[%d] pid %d: сигнал %d", job->number, job->pid, WTERMSIG(status));
+    len += snprintf(report + len, sizeof(report) - len, ", %.3f мс, user %.3f мс, sys %.3f мс, maxrss %ld КБ\n",
+                    ElapsedMs(&job->start, &now), TimevalMs(&ru->ru_utime), TimevalMs(&ru->ru_stime),
+                    ru->ru_maxrss);
+    if (output)
+        CaptureTextAfter(output, job->label, report, (size_t)len);
+    else
+        fputs(report, stdout);
+}
+
+/* Выполняет задания из файла (или stdin для "-"), не больше parallel
+ * одновременно. Каждый процесс отслеживается через pidfd в epoll и снимается
+ * wait4() сразу после завершения, с его собственным rusage. С capture
+ * каналы вывода заданий читаются в том же epoll. */
+int RunBatch(const char *file, int parallel, EnvSnapshot *child_env, const ChildTarget targets[], int use_fork,
+             int capture, const char *capture_dir) {
+    FILE *jobs_file = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (!jobs_file) {
+        perror(file);
+        return -1;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    Job *jobs = calloc(parallel, sizeof(Job));
+    int *free_slots = malloc(parallel * sizeof(int));
+    struct epoll_event *events = malloc(parallel * sizeof(struct epoll_event));
+    if (epfd < 0 || !jobs || !free_slots || !events) {
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
+    Capture output;
+    if (capture && CaptureInit(&output, epfd, capture_dir) < 0)
+        capture = 0;
+    for (int i = 0; i < parallel; i++)
+        free_slots[i] = parallel - 1 - i;
+
+    int free_count = parallel;
+    int running = 0;
+    int launched = 0;
+    int failed = 0;
+    int more = 1;
+    char *line = NULL;
+    size_t line_cap = 0;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    while (more || running > 0) {
+        while (more && free_count > 0) {
+            if (getline(&line, &line_cap, jobs_file) < 0) {
+                more = 0;
+                break;
+            }
+            char *argv_job[MAX_JOB_ARGS + 1];
+            char *delta[MAX_JOB_ARGS];
+            int delta_count;
+            char child_name[16];
+            const char *path;
+            int parsed = ParseJob(line, argv_job, delta, &delta_count, targets, child_name, sizeof(child_name),
+                                  launched + 1, &path);
+            if (parsed == 0)
+                continue;
+            launched++;
+            if (parsed == -2) {
+                fprintf(stderr, "Ошибка: слишком много слов в строке задания %d\n", launched);
+                failed++;
+                continue;
+            }
+            if (parsed < 0) {
+                fprintf(stderr, "Ошибка: CHILD_PATH не найден\n");
+                failed++;
+                continue;
+            }
+
+            Job *job = &jobs[free_slots[free_count - 1]];
+            job->kind = EPOLL_KIND_JOB;
+            job->number = launched;
+            if (path)
+                snprintf(job->label, sizeof(job->label), "%s", child_name);
+            else
+                snprintf(job->label, sizeof(job->label), "job_%d", launched);
+            int std_fds[2];
+            int captured = CaptureOpen(capture ? &output : NULL, job->label, std_fds);
+            if (captured < 0) {
+                failed++;
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &job->start);
+            char **job_env = EnvApply(child_env, delta, (size_t)delta_count);
+            job->pid = LaunchJob(path, argv_job, job_env, use_fork, captured ? std_fds : NULL);
+            EnvRestore(child_env);
+            if (captured)
+                CaptureClose(std_fds);
+            if (job->pid < 0) {
+                if (captured)
+                    CaptureDiscard(&output, job->label);
+                failed++;
+                continue;
+            }
+            job->pidfd = (int)syscall(SYS_pidfd_open, job->pid, 0);
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = job };
+            if (job->pidfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, job->pidfd, &ev) < 0) {
+                /* Без pidfd (ядро до 5.3) ждём этот процесс синхронно. */
+                int status;
+                struct rusage ru;
+                if (job->pidfd >= 0)
+                    close(job->pidfd);
+                if (wait4(job->pid, &status, 0, &ru) > 0) {
+                    ReportJob(job, status, &ru, capture ? &output : NULL);
+                    failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+                }
+                continue;
+            }
+            free_count--;
+            running++;
         }
+        if (running == 0)
+            continue;
 
-        char *argv_child[3];
-        argv_child[0] = child_name;
-        if (mode == '+')
-            argv_child[1] = "env";
-        else
-            argv_child[1] = NULL;
+        int n;
+        if (capture) {
+            n = CapturePoll(&output, events, parallel, -1);
+        } else {
+            n = epoll_wait(epfd, events, parallel, -1);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                perror("epoll_wait");
+        }
+        if (n < 0)
+            break;
+        for (int i = 0; i < n; i++) {
+            Job *job = events[i].data.ptr;
+            int status;
+            struct rusage ru;
+            if (wait4(job->pid, &status, WNOHANG, &ru) <= 0)
+                continue;
+            ReportJob(job, status, &ru, capture ? &output : NULL);
+            failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            epoll_ctl(epfd, EPOLL_CTL_DEL, job->pidfd, NULL);
+            close(job->pidfd);
+            free_slots[free_count++] = (int)(job - jobs);
+            running--;
+        }
+    }
+
+    if (capture) {
+        CaptureFinish(&output);
+        CaptureFree(&output);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double total = ElapsedMs(&begin, &end);
+    printf("Заданий: %d, с ошибкой: %d, %.1f мс, %.0f запусков/с\n", launched, failed, total,
+           total > 0 ? launched / (total / 1e3) : 0.0);
+
+    free(line);
+    free(events);
+    free(free_slots);
+    free(jobs);
+    close(epfd);
+    if (jobs_file != stdin)
+        fclose(jobs_file);
+    return failed ? -1 : 0;
+}
+
+int LatencyCmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
 
-        argv_child[2] = NULL;
-        execve(child_prog_path, argv_child, child_env);
-        perror("execve");
+void Percentiles(double *latency, int count, double result[3]) {
+    qsort(latency, count, sizeof(double), LatencyCmp);
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += latency[i];
+    result[0] = count ? sum / count : 0;
+    result[1] = count ? latency[count / 2] : 0;
+    result[2] = count ? latency[(int)(count * 0.99)] : 0;
+}
+
+/* Время от запуска до завершения child (вывод child в /dev/null), для zygote
+ * ещё и до готовности. Копии zygote не дети родителя, их завершение
+ * ждём через pidfd. */
+void CompareLaunch(char **child_env, const ChildTarget targets[], int count) {
+    const char *path = ChildTargetPath(targets, '*');
+    if (!path) {
+        fprintf(stderr, "Ошибка: CHILD_PATH не найден\n");
+        return;
+    }
+    double *latency = malloc(count * sizeof(double));
+    double *ready = malloc(count * sizeof(double));
+    if (!latency || !ready) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    char child_name[] = "child_bench";
+    char *argv_child[] = { child_name, NULL };
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (saved < 0 || null < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *names[4] = { "posix_spawn", "fork+execve", "zygote", "zygote" };
+    const char *what[4] = { "завершение", "завершение", "завершение", "готовность" };
+    double results[4][3] = { { 0 } };
+    int rows = 0;
+    for (int method = 0; method < 3; method++) {
+        dup2(null, STDOUT_FILENO);
+        Zygote zygote;
+        if (method == 2 && StartZygote(&zygote, child_env) < 0) {
+            dup2(saved, STDOUT_FILENO);
+            break;
+        }
+        int done = 0;
+        for (int i = 0; i < count; i++) {
+            struct timespec t0, t1, t2;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            pid_t pid;
+            if (method < 2) {
+                pid = LaunchChild(path, argv_child, child_env, method == 1, NULL);
+                if (pid < 0)
+                    break;
+                waitpid(pid, NULL, 0);
+            } else {
+                pid = ZygoteLaunch(&zygote, '*', i, NULL);
+                if (pid < 0)
+                    break;
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                ready[done] = ElapsedMs(&t0, &t1) * 1e3;
+                int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+                if (pidfd >= 0) {
+                    struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+                    poll(&pfd, 1, -1);
+                    close(pidfd);
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            latency[done++] = ElapsedMs(&t0, &t2) * 1e3;
+        }
+        if (method == 2)
+            StopZygote(&zygote);
+        dup2(saved, STDOUT_FILENO);
+
+        Percentiles(latency, done, results[rows++]);
+        if (method == 2)
+            Percentiles(ready, done, results[rows++]);
+    }
+    close(null);
+    close(saved);
+    free(latency);
+    free(ready);
+
+    printf("Запуск child, %d запусков, мкс:\n", count);
+    printf("  %-12s %-11s %10s %10s %10s\n", "", "до", "среднее", "p50", "p99");
+    /* Строки только для методов, которые удалось запустить. */
+    for (int i = 0; i < rows; i++)
+        printf("  %-12s %-11s %10.1f %10.1f %10.1f\n", names[i], what[i],
+               results[i][0], results[i][1], results[i][2]);
+}
+
+void RunCommand(char **child_env, char input, const ChildTarget targets[], int use_fork, Zygote *zygote,
+                Capture *output) {
+    switch (input) {
+        case '+':
+        case '*':
+        case '&':
+            StartChild(child_env, input, targets, use_fork, zygote, output);
+            break;
+        default:
+            printf("Неизвестная команда\n");
+            break;
+    }
+    ReapChildren();
+}
+
+/* Интерактивный режим с --capture: команды читаются из stdin в том же
+ * epoll, что и каналы child, так что вывод child вычитывается и пока
+ * родитель ждёт ввода. */
+void RunCaptured(char **child_env, const ChildTarget targets[], int use_fork, Zygote *zygote,
+                 const char *capture_dir) {
+    static int input_kind = EPOLL_KIND_INPUT;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    Capture output;
+    if (epfd < 0 || CaptureInit(&output, epfd, capture_dir) < 0) {
+        perror("epoll");
         exit(EXIT_FAILURE);
-        wait(NULL);
     }
+    /* Обычный файл в epoll не добавить, но он и так всегда готов. */
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &input_kind };
+    int input_polled = epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+
+    int quit = 0;
+    while (!quit) {
+        struct epoll_event events[16];
+        int n = CapturePoll(&output, events, 16, input_polled ? -1 : 0);
+        if (n < 0)
+            break;
+        if (input_polled && n == 0)
+            continue;
+        char commands[256];
+        ssize_t len = read(STDIN_FILENO, commands, sizeof(commands));
+        if (len <= 0)
+            break;
+        for (ssize_t i = 0; i < len && !quit; i++) {
+            if (commands[i] == 'q')
+                quit = 1;
+            else if (commands[i] != ' ' && commands[i] != '\t' && commands[i] != '\n')
+                RunCommand(child_env, commands[i], targets, use_fork, zygote, &output);
+        }
+        fflush(stdout);
+    }
+
+    if (input_polled)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+    CaptureFinish(&output);
+    CaptureFree(&output);
+    close(epfd);
 }
 
 int main(int argc, char *argv[], char *envp[]) {
+    int use_fork = 0;
+    int compare = 0;
+    int parallel = 1;
+    int use_zygote = 0;
+    int capture = 0;
+    const char *capture_dir = NULL;
+    const char *batch = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fork") == 0) {
+            use_fork = 1;
+        } else if (strcmp(argv[i], "--zygote") == 0) {
+            use_zygote = 1;
+        } else if (strcmp(argv[i], "--capture") == 0) {
+            capture = 1;
+        } else if (strcmp(argv[i], "--capture-dir") == 0 && i + 1 < argc) {
+            capture = 1;
+            capture_dir = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch = argv[++i];
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            parallel = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            compare = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Использование: %s [--fork | --zygote] [--capture | --capture-dir DIR] [--compare N] [--batch FILE [-P N]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* --compare сам перебирает все способы запуска, а пакетный режим
+     * запускает child через LaunchChild() без zygote. */
+    if ((compare && (use_fork || use_zygote)) || (batch && use_zygote)) {
+        fprintf(stderr, "Ошибка: %s несовместим с %s\n", use_fork ? "--fork" : "--zygote",
+                compare ? "--compare" : "--batch");
+        exit(EXIT_FAILURE);
+    }
 
     if (setenv("LC_COLLATE", "C", 1) != 0) {
         perror("Ошибка установки LC_COLLATE");
@@ -161,9 +844,30 @@ int main(int argc, char *argv[], char *envp[]) {
     }
 
     setlocale(LC_ALL, "C");
-    PrintEnvSorted();
+    EnvSnapshot parent_env, child_snapshot;
+    EnvInit(&parent_env);
+    EnvCapture(&parent_env, environ);
+    PrintEnvSorted(&parent_env);
+
+    CreateChildEnv(&parent_env, &child_snapshot);
+    char **child_env = child_snapshot.vector;
+    ChildTarget targets[CHILD_MODE_COUNT];
+    ResolveChildTargets(targets, &child_snapshot, &parent_env);
+
+    if (compare || batch) {
+        int status = 0;
+        if (compare)
+            CompareLaunch(child_env, targets, compare);
+        else
+            status = RunBatch(batch, parallel, &child_snapshot, targets, use_fork, capture, capture_dir) < 0;
+        EnvFree(&child_snapshot);
+        EnvFree(&parent_env);
+        return status;
+    }
 
-    char **child_env = CreateChildEnv();
+    Zygote zygote;
+    if (use_zygote && StartZygote(&zygote, child_env) < 0)
+        use_zygote = 0;
 
     printf("Введите команду:\n");
     printf("  '+' : запустить child с чтением переменных из файла\n");
@@ -171,25 +875,22 @@ int main(int argc, char *argv[], char *envp[]) {
     printf("  '&' : запустить child с поиском CHILD_PATH в глобальном окружении\n");
     printf("  'q' : завершить работу программы\n");
 
-    char input;
-    while (scanf(" %c", &input) == 1 && input != 'q') {
-        switch (input) {
-            case '+':
-            case '*':
-            case '&':
-                StartChild(child_env, input);
-                break;
-            default:
-                printf("Неизвестная команда\n");
-                break;
+    if (capture) {
+        RunCaptured(child_env, targets, use_fork, use_zygote ? &zygote : NULL, capture_dir);
+    } else {
+        char input;
+        while (scanf(" %c", &input) == 1 && input != 'q') {
+            RunCommand(child_env, input, targets, use_fork, use_zygote ? &zygote : NULL, NULL);
+            printf("Введите команду (+, *, &, q): ");
         }
-        printf("Введите команду (+, *, &, q): ");
     }
+    if (use_zygote)
+        StopZygote(&zygote);
+    while (wait(NULL) > 0)
+        ;
 
-    for (int i = 0; child_env[i] != NULL; i++) {
-        free(child_env[i]);
-    }
-    free(child_env);
+    EnvFree(&child_snapshot);
+    EnvFree(&parent_env);
 
     return 0;
 }
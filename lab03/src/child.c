@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <time.h>
 #include <unistd.h>
+#include "protocol.h"
+#include "stats.h"
 
 typedef struct {
     int first;
@@ -17,12 +19,14 @@ void InitSignalsHandling();
 void UsrSignHandler(int signo);
 void AlrSignHandler(int signo);
 void UpdateStat();
+void RequestPrint();
 
 bool can_print = false;
 bool received_signal = false;
 
 Pair occurrence;
 size_t c00 = 0, c01 = 0, c10 = 0, c11 = 0;
+StatsSlot *stats_slot = NULL;
 
 
 void UpdateStat() {
@@ -51,8 +55,17 @@ void UpdateStat() {
     counter++;
 }
 
-int main() {
+/* argv[1] и argv[2] — fd общей памяти статистики и номер слота. */
+int main(int argc, char *argv[]) {
     srand(time(NULL));
+    if (argc >= 3) {
+        int fd = atoi(argv[1]);
+        int slot = atoi(argv[2]);
+        StatsRegion *stats = slot >= 0 && slot < STATS_SLOTS ? StatsAttach(fd) : NULL;
+        if (stats)
+            stats_slot = &stats->slots[slot];
+        close(fd);
+    }
 
     InitSignalsHandling();
 
@@ -69,10 +82,7 @@ int main() {
 
             union sigval info = { .sival_int = getpid() };
             info.sival_int = getpid();
-            while (!received_signal) {
-                sigqueue(getppid(), SIGUSR1, info);
-                sleep(1);
-            }
+            RequestPrint();
 
             alarm(rand() % 1 + 1);
             if (!can_print) {
@@ -83,15 +93,42 @@ int main() {
             printf("-------------------------------------------\n");
             printf("ppid - %5d\tpid  - %5d\t", (int)getppid(), (int)getpid());
             printf("00   - %5zu; 01   - %5zu; 10   - %5zu; 11   - %5zu\n", c00, c01, c10, c11);
+            fflush(stdout);
             i = 0;
 
-            sigqueue(getppid(), SIGUSR2, info);
+            sigqueue(getppid(), SIG_PRINT_DONE, info);
         }
     }
     return 0;
 }
 
 
+/* Запрос уходит один раз: сигнал реального времени у родителя не теряется.
+ * Повтор нужен, только если очередь сигналов переполнена (EAGAIN). Ответ
+ * ждём в sigsuspend(), с SIGUSR1/SIGUSR2 заблокированными до него, чтобы
+ * ответ не пришёл между проверкой флага и ожиданием. */
+void RequestPrint() {
+    sigset_t usr_set, old_set;
+    sigemptyset(&usr_set);
+    sigaddset(&usr_set, SIGUSR1);
+    sigaddset(&usr_set, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &usr_set, &old_set);
+
+    union sigval info = { .sival_int = getpid() };
+    while (!received_signal) {
+        if (sigqueue(getppid(), SIG_PRINT_REQUEST, info) < 0) {
+            if (errno != EAGAIN)
+                break;
+            struct timespec delay = { .tv_sec = 0, .tv_nsec = 10 * 1000 * 1000 };
+            nanosleep(&delay, NULL);
+            continue;
+        }
+        while (!received_signal)
+            sigsuspend(&old_set);
+    }
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
+}
+
 void InitSignalsHandling() {
     struct sigaction action = {0};
     sigset_t set;
@@ -131,5 +168,9 @@ void AlrSignHandler(int signo) {
     else if (occurrence.first == 1 && occurrence.second == 1)
         c11++;
 
+    if (stats_slot) {
+        uint64_t counters[STATS_COUNTERS] = { c00, c01, c10, c11 };
+        StatsPublish(stats_slot, counters);
+    }
     alarm(rand() % 1 + 1);
 }
@@ -8,23 +8,62 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include "protocol.h"
+#include "stats.h"
 
 #define CAPACITY 8
+#define SIGNAL_BATCH 64
+#define INPUT_SIZE 256
 
 typedef struct {
     pid_t pid;
     char name[CAPACITY * 2];
     bool is_running;
+    bool waiting;
+    int slot;
 } ProcessInfo;
 
+/* Очередь child, ждущих разрешения на вывод: разрешение получает один,
+ * следующий — после его SIG_PRINT_DONE или завершения. */
+typedef struct {
+    pid_t *pids;
+    size_t head;
+    size_t size;
+    size_t capacity;
+} PrintQueue;
+
 size_t child_processes_size = 0;
 size_t child_processes_capacity = CAPACITY;
 ProcessInfo *child_processes = NULL;
 const char *child_name = "./build/debug/child";
 
+PrintQueue print_queue = {0};
+pid_t printing_pid = 0;
+sigset_t child_mask;
+int signal_fd = -1;
+int epoll_fd = -1;
+bool input_polled = true;
+
+/* Слоты статистики освобождаются только после waitpid(): убитый, но ещё
+ * не снятый child мог бы писать в слот нового. */
+StatsRegion *stats = NULL;
+int stats_fd = -1;
+int free_slots[STATS_SLOTS];
+size_t free_slot_count = 0;
+int timer_fd = -1;
+bool watching = false;
+
 void InitSignals();
-void HandleSignal(int signo, siginfo_t *info, void *context);
-void HandleExitChild(int signo);
+void HandleSignals();
+void HandleSignal(const struct signalfd_siginfo *info);
+void HandleExitChild();
+void HandleInput();
+void RunCommand(const char *input);
 void CreateChild();
 void DeleteLastChild();
 void ListChild();
@@ -34,62 +73,61 @@ void WaitChild();
 void print_menu();
 void StartChild(size_t index);
 void StopChild(size_t index);
+ProcessInfo *FindChild(pid_t pid);
+void QueuePrint(pid_t pid);
+void GrantNextPrint();
+void InitStats();
+void ReleaseSlot(pid_t pid);
+void PrintStats(bool per_child);
+void ToggleWatch();
 
 
 
+/* SIGUSR1/SIGUSR2/SIGCHLD и запросы child заблокированы и читаются через
+ * signalfd в том же epoll, что и stdin: обработка идёт синхронно, пачками,
+ * без асинхронных обработчиков. */
 int main() {
     srand(time(NULL));
-    InitSignals();
     child_processes = (ProcessInfo *)calloc(child_processes_capacity, sizeof(ProcessInfo));
     if (!child_processes) {
         perror("Failed to allocate memory");
         exit(EXIT_FAILURE);
     }
+    InitSignals();
+    InitStats();
 
     print_menu();
-    char input[CAPACITY];
+    printf("> ");
+    fflush(stdout);
     while (true) {
-        printf("> ");
-        fflush(stdout);
-        if (fgets(input, sizeof(input), stdin) == NULL)
-            continue;
-
-        char option = input[0];
-        int index = -1;
-        if (strlen(input) > 1 && (input[1] >= '0' && input[1] <= '9')) {
-            index = input[1] - '0';
+        struct epoll_event events[3];
+        int n = epoll_wait(epoll_fd, events, 3, input_polled ? -1 : 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            CleanExit();
         }
-
-        switch (option) {
-            case '+':
-                CreateChild();
-                break;
-            case '-':
-                DeleteLastChild();
-                break;
-            case 'l':
-                ListChild();
-                break;
-            case 'k':
-                DeleteAllChild();
-                break;
-            case 's':
-                StopChild(index);
-                break;
-            case 'g':
-                StartChild(index);
-                break;
-            case 'q':
-                CleanExit();
-                break;
-            default:
-                printf("Invalid option. Type 'm' for menu.\n");
-                break;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == signal_fd) {
+                HandleSignals();
+            } else if (events[i].data.fd == timer_fd) {
+                uint64_t ticks;
+                if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks))
+                    PrintStats(false);
+            } else {
+                HandleInput();
+            }
         }
+        if (!input_polled)
+            HandleInput();
+        fflush(stdout);
     }
     return 0;
 }
 
+/* SIGUSR2 уже ответил child на запрос, так что его место в очереди
+ * устаревает и GrantNextPrint() его пропустит. */
 void StartChild(size_t index) {
     if (index >= child_processes_size) {
         printf("Invalid index\n");
@@ -101,10 +139,13 @@ void StartChild(size_t index) {
 
     sigqueue(pid, SIGUSR2, info);
     child_processes[index].is_running = true;
+    child_processes[index].waiting = false;
     printf("Started child %s, PID %d\n", child_processes[index].name, pid);
 }
 
 
+/* Остановленный child получает отказ и больше не ждёт, поэтому из очереди
+ * на вывод он уходит. */
 void StopChild(size_t index) {
     if (index >= child_processes_size) {
         printf("Invalid index\n");
@@ -116,6 +157,7 @@ void StopChild(size_t index) {
 
     sigqueue(pid, SIGUSR1, info);
     child_processes[index].is_running = false;
+    child_processes[index].waiting = false;
     printf("Stopped child %s, PID %d\n", child_processes[index].name, pid);
 }
 
@@ -130,40 +172,191 @@ void WaitChild() {
 }
 
 void InitSignals() {
-    struct sigaction action = {0};
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGUSR1);
-    sigaddset(&set, SIGUSR2);
-    sigaddset(&set, SIGCHLD);
-
-    action.sa_flags = SA_SIGINFO;
-    action.sa_mask = set;
-    action.sa_sigaction = HandleSignal;
-    sigaction(SIGUSR1, &action, NULL);
-    sigaction(SIGUSR2, &action, NULL);
-
-    action.sa_handler = HandleExitChild;
-    sigaction(SIGCHLD, &action, NULL);
+    sigemptyset(&child_mask);
+    sigaddset(&child_mask, SIGUSR1);
+    sigaddset(&child_mask, SIGUSR2);
+    sigaddset(&child_mask, SIGCHLD);
+    sigaddset(&child_mask, SIG_PRINT_REQUEST);
+    sigaddset(&child_mask, SIG_PRINT_DONE);
+    if (sigprocmask(SIG_BLOCK, &child_mask, NULL) < 0) {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+
+    signal_fd = signalfd(-1, &child_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd < 0 || epoll_fd < 0) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = signal_fd };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+    /* Обычный файл в epoll не добавить, но он и так всегда готов. */
+    ev.data.fd = STDIN_FILENO;
+    input_polled = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+}
+
+/* Без общей памяти child работают как раньше, только без статистики. */
+void InitStats() {
+    stats = StatsCreate(&stats_fd);
+    for (int i = STATS_SLOTS - 1; stats && i >= 0; i--)
+        free_slots[free_slot_count++] = i;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = timer_fd };
+    if (timer_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0)
+        perror("timerfd");
+}
+
+void ReleaseSlot(pid_t pid) {
+    for (int i = 0; stats && i < STATS_SLOTS; i++) {
+        if (atomic_load_explicit(&stats->slots[i].pid, memory_order_relaxed) == pid) {
+            atomic_store_explicit(&stats->slots[i].pid, 0, memory_order_relaxed);
+            free_slots[free_slot_count++] = i;
+            return;
+        }
+    }
+}
+
+/* Читает счётчики всех child прямо из их слотов, ни одного сигнала. */
+void PrintStats(bool per_child) {
+    if (!stats) {
+        printf("Statistics are not available\n");
+        return;
+    }
+    uint64_t total[STATS_COUNTERS] = {0};
+    size_t counted = 0, busy = 0;
+    for (size_t i = 0; i < child_processes_size; i++) {
+        ProcessInfo *child = &child_processes[i];
+        pid_t pid;
+        uint64_t counters[STATS_COUNTERS];
+        if (child->slot < 0)
+            continue;
+        if (StatsRead(&stats->slots[child->slot], &pid, counters) < 0 || pid != child->pid) {
+            busy++;
+            continue;
+        }
+        for (int c = 0; c < STATS_COUNTERS; c++)
+            total[c] += counters[c];
+        counted++;
+        if (per_child) {
+            printf("Child %s, PID %d: 00 - %5" PRIu64 "; 01 - %5" PRIu64 "; 10 - %5" PRIu64 "; 11 - %5" PRIu64 "\n",
+                   child->name, pid, counters[0], counters[1], counters[2], counters[3]);
+        }
+    }
+    printf("Total (%zu children", counted);
+    if (busy)
+        printf(", %zu unavailable", busy);
+    printf("): 00 - %" PRIu64 "; 01 - %" PRIu64 "; 10 - %" PRIu64 "; 11 - %" PRIu64 "\n",
+           total[0], total[1], total[2], total[3]);
+}
+
+void ToggleWatch() {
+    watching = !watching;
+    struct itimerspec period = {0};
+    if (watching) {
+        period.it_interval.tv_sec = 1;
+        period.it_value.tv_sec = 1;
+    }
+    if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &period, NULL) < 0) {
+        perror("timerfd_settime");
+        watching = false;
+        return;
+    }
+    printf("Live statistics %s\n", watching ? "on" : "off");
 }
 
-void HandleSignal(int signo, siginfo_t *info, void *context) {
-    (void)context;
-    if (signo == SIGUSR1) {
-        pid_t child_pid = info->si_value.sival_int;
-        printf("Parent: Received SIGUSR1 from child %d\n", child_pid);
-
-        union sigval info_resume = { .sival_int = 0 };
-        info_resume.sival_int = 0;
-        sigqueue(child_pid, SIGUSR2, info_resume);
-    } else if (signo == SIGUSR2) {
-        pid_t child_pid = info->si_value.sival_int;
+/* Вычитывает из signalfd всё, что накопилось, по SIGNAL_BATCH за read(). */
+void HandleSignals() {
+    struct signalfd_siginfo infos[SIGNAL_BATCH];
+    for (;;) {
+        ssize_t n = read(signal_fd, infos, sizeof(infos));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        size_t count = (size_t)n / sizeof(infos[0]);
+        for (size_t i = 0; i < count; i++)
+            HandleSignal(&infos[i]);
+        if (count < SIGNAL_BATCH)
+            break;
+    }
+}
+
+void HandleSignal(const struct signalfd_siginfo *info) {
+    int signo = (int)info->ssi_signo;
+    pid_t child_pid = info->ssi_pid ? (pid_t)info->ssi_pid : (pid_t)info->ssi_int;
+    if (signo == SIGCHLD) {
+        HandleExitChild();
+    } else if (signo == SIG_PRINT_REQUEST || signo == SIGUSR1) {
+        printf("Parent: Received print request from child %d\n", child_pid);
+        QueuePrint(child_pid);
+    } else if (signo == SIG_PRINT_DONE || signo == SIGUSR2) {
         printf("Parent: Child %d has finished output\n", child_pid);
+        if (child_pid == printing_pid) {
+            printing_pid = 0;
+            GrantNextPrint();
+        }
+    }
+}
+
+ProcessInfo *FindChild(pid_t pid) {
+    for (size_t i = 0; i < child_processes_size; i++) {
+        if (child_processes[i].pid == pid)
+            return &child_processes[i];
+    }
+    return NULL;
+}
+
+/* Запрос от printing_pid значит, что child не дождался разрешения (оно
+ * досталось ему по устаревшей записи в очереди) — разрешение повторяется. */
+void QueuePrint(pid_t pid) {
+    ProcessInfo *child = FindChild(pid);
+    if (child && pid == printing_pid) {
+        union sigval info = { .sival_int = 0 };
+        sigqueue(pid, SIGUSR2, info);
+        return;
+    }
+    if (!child || child->waiting)
+        return;
+    if (print_queue.size == print_queue.capacity) {
+        size_t capacity = print_queue.capacity ? print_queue.capacity * 2 : CAPACITY;
+        pid_t *pids = (pid_t *)malloc(capacity * sizeof(pid_t));
+        if (!pids) {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < print_queue.size; i++)
+            pids[i] = print_queue.pids[(print_queue.head + i) % print_queue.capacity];
+        free(print_queue.pids);
+        print_queue.pids = pids;
+        print_queue.head = 0;
+        print_queue.capacity = capacity;
+    }
+    print_queue.pids[(print_queue.head + print_queue.size++) % print_queue.capacity] = pid;
+    child->waiting = true;
+    GrantNextPrint();
+}
+
+/* Child, завершившиеся или остановленные в очереди, пропускаются. */
+void GrantNextPrint() {
+    while (printing_pid == 0 && print_queue.size > 0) {
+        pid_t pid = print_queue.pids[print_queue.head];
+        print_queue.head = (print_queue.head + 1) % print_queue.capacity;
+        print_queue.size--;
+
+        ProcessInfo *child = FindChild(pid);
+        if (!child || !child->waiting)
+            continue;
+        child->waiting = false;
+        union sigval info = { .sival_int = 0 };
+        if (sigqueue(pid, SIGUSR2, info) == 0)
+            printing_pid = pid;
     }
 }
 
-void HandleExitChild(int signo) {
-    (void)signo;
+void HandleExitChild() {
     pid_t pid;
     int status;
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
@@ -177,17 +370,111 @@ void HandleExitChild(int signo) {
                 break;
             }
         }
+        if (pid == printing_pid)
+            printing_pid = 0;
+        ReleaseSlot(pid);
+    }
+    GrantNextPrint();
+}
+
+/* stdin читается через read(), а не fgets(): данные, осевшие в буфере
+ * stdio, epoll бы не увидел. */
+void HandleInput() {
+    static char input[INPUT_SIZE];
+    static size_t input_len = 0;
+    ssize_t n = read(STDIN_FILENO, input + input_len, sizeof(input) - 1 - input_len);
+    if (n <= 0) {
+        if (n < 0 && errno == EINTR)
+            return;
+        CleanExit();
+    }
+    input_len += (size_t)n;
+
+    char *line = input;
+    char *end;
+    while ((end = memchr(line, '\n', input + input_len - line)) != NULL) {
+        *end = '\0';
+        RunCommand(line);
+        printf("> ");
+        line = end + 1;
+    }
+    input_len -= (size_t)(line - input);
+    memmove(input, line, input_len);
+    if (input_len == sizeof(input) - 1)
+        input_len = 0;
+}
+
+void RunCommand(const char *input) {
+    if (strcmp(input, "stats") == 0) {
+        PrintStats(true);
+        return;
+    }
+    if (strcmp(input, "watch") == 0) {
+        ToggleWatch();
+        return;
+    }
+    char option = input[0];
+    size_t index = (size_t)-1;
+    if (input[0] != '\0' && input[1] >= '0' && input[1] <= '9') {
+        index = strtoul(input + 1, NULL, 10);
+    }
+
+    switch (option) {
+        case '+':
+            CreateChild();
+            break;
+        case '-':
+            DeleteLastChild();
+            break;
+        case 'l':
+            ListChild();
+            break;
+        case 'k':
+            DeleteAllChild();
+            break;
+        case 's':
+            StopChild(index);
+            break;
+        case 'g':
+            StartChild(index);
+            break;
+        case 'm':
+            print_menu();
+            break;
+        case 'q':
+            CleanExit();
+            break;
+        default:
+            printf("Invalid option. Type 'm' for menu.\n");
+            break;
     }
 }
 
 void CreateChild() {
+    int slot = free_slot_count > 0 ? free_slots[--free_slot_count] : -1;
+    if (slot >= 0) {
+        StatsSlot *stats_slot = &stats->slots[slot];
+        atomic_store_explicit(&stats_slot->seq, 0, memory_order_relaxed);
+        for (int c = 0; c < STATS_COUNTERS; c++)
+            atomic_store_explicit(&stats_slot->counters[c], 0, memory_order_relaxed);
+    }
+    fflush(stdout);
     pid_t pid = fork();
     if (pid == -1) {
         perror("Failed to fork");
+        if (slot >= 0)
+            free_slots[free_slot_count++] = slot;
         return;
     }
     if (pid == 0) {
-        execl(child_name, child_name, NULL);
+        sigprocmask(SIG_UNBLOCK, &child_mask, NULL);
+        char fd_arg[16], slot_arg[16];
+        snprintf(fd_arg, sizeof(fd_arg), "%d", stats_fd);
+        snprintf(slot_arg, sizeof(slot_arg), "%d", slot);
+        if (slot >= 0)
+            execl(child_name, child_name, fd_arg, slot_arg, NULL);
+        else
+            execl(child_name, child_name, NULL);
         perror("Failed to exec");
         exit(EXIT_FAILURE);
     } else {
@@ -204,6 +491,10 @@ void CreateChild() {
         child_processes[child_processes_size].pid = pid;
 
         child_processes[child_processes_size].is_running = false;
+        child_processes[child_processes_size].waiting = false;
+        child_processes[child_processes_size].slot = slot;
+        if (slot >= 0)
+            atomic_store_explicit(&stats->slots[slot].pid, pid, memory_order_relaxed);
         child_processes_size++;
         printf("Created child %s, PID %d\n", child_processes[child_processes_size - 1].name, pid);
     }
@@ -236,23 +527,27 @@ void ListChild() {
 
 
 void DeleteAllChild() {
-    sigset_t block_mask, old_mask;
-    sigemptyset(&block_mask);
-    sigaddset(&block_mask, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
-
     while (child_processes_size > 0) {
         DeleteLastChild();
     }
-
-    sigprocmask(SIG_SETMASK, &old_mask, NULL);
     printf("All children deleted\n");
 }
 
+/* Удалённые child уже убраны из таблицы, их снимаем сами: SIGCHLD
+ * заблокирован и обработчика больше нет. */
 void CleanExit() {
     DeleteAllChild();
     WaitChild();
+    while (waitpid(-1, NULL, 0) > 0)
+        ;
     free(child_processes);
+    free(print_queue.pids);
+    if (stats)
+        munmap(stats, sizeof(StatsRegion));
+    close(stats_fd);
+    close(timer_fd);
+    close(signal_fd);
+    close(epoll_fd);
     printf("Exiting...\n");
     exit(EXIT_SUCCESS);
 }
@@ -265,5 +560,7 @@ void print_menu() {
     printf("k - Delete all children\n");
     printf("s<ind> - Stop child at index \n");
     printf("g<ind> - Start child at index \n");
+    printf("stats - Show counters of every child\n");
+    printf("watch - Toggle live totals every second\n");
     printf("q - Quit\n");
 }
@@ -0,0 +1,13 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <signal.h>
+
+/* Запрос child на вывод и сообщение об окончании вывода. Сигналы реального
+ * времени ставятся в очередь: сотни одновременных запросов доходят все,
+ * а SIGUSR1/SIGUSR2 от разных child слились бы в один. Ответ родителя
+ * по-прежнему SIGUSR2 (можно) или SIGUSR1 (нельзя). */
+#define SIG_PRINT_REQUEST (SIGRTMIN)
+#define SIG_PRINT_DONE    (SIGRTMIN + 1)
+
+#endif
@@ -0,0 +1,52 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+/* Область живёт в memfd: fd без CLOEXEC переживает execve, и child
+ * отображает ту же память по номеру fd из argv. */
+StatsRegion *StatsCreate(int *fd) {
+    *fd = memfd_create("lab03-stats", 0);
+    if (*fd < 0 || ftruncate(*fd, sizeof(StatsRegion)) < 0) {
+        perror("memfd_create");
+        return NULL;
+    }
+    return StatsAttach(*fd);
+}
+
+StatsRegion *StatsAttach(int fd) {
+    void *region = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return region;
+}
+
+/* Единственный писатель слота; годится и для обработчика сигнала. */
+void StatsPublish(StatsSlot *slot, const uint64_t counters[STATS_COUNTERS]) {
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < STATS_COUNTERS; i++)
+        atomic_store_explicit(&slot->counters[i], counters[i], memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+/* 0 — согласованный снимок; -1 — слот всё время менялся (или писатель
+ * умер посреди записи) за STATS_RETRIES попыток. */
+int StatsRead(StatsSlot *slot, pid_t *pid, uint64_t counters[STATS_COUNTERS]) {
+    for (int attempt = 0; attempt < STATS_RETRIES; attempt++) {
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        *pid = atomic_load_explicit(&slot->pid, memory_order_relaxed);
+        for (int i = 0; i < STATS_COUNTERS; i++)
+            counters[i] = atomic_load_explicit(&slot->counters[i], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+            return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,30 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define STATS_SLOTS     4096
+#define STATS_COUNTERS  4
+#define STATS_RETRIES   64
+
+/* Слот одного child в общей памяти. Пишет только child (seq нечётный на
+ * время записи), читает родитель без сигналов: если seq поменялся за время
+ * чтения, чтение повторяется. Слот занимает свою кэш-линию. */
+typedef struct {
+    _Alignas(64) atomic_uint seq;
+    atomic_int pid;
+    atomic_uint_fast64_t counters[STATS_COUNTERS];
+} StatsSlot;
+
+typedef struct {
+    StatsSlot slots[STATS_SLOTS];
+} StatsRegion;
+
+StatsRegion *StatsCreate(int *fd);
+StatsRegion *StatsAttach(int fd);
+void StatsPublish(StatsSlot *slot, const uint64_t counters[STATS_COUNTERS]);
+int  StatsRead(StatsSlot *slot, pid_t *pid, uint64_t counters[STATS_COUNTERS]);
+
+#endif